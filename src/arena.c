@@ -0,0 +1,155 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include "arena.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "util.h"
+
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
+
+// the header of every arena sits right before its memory
+#define ARENA_HEADER_SIZE ARENA_ALIGN_UP(sizeof(Arena))
+
+static size_t arena_stride(ArenaPool *pool) {
+    return ARENA_HEADER_SIZE + pool->arena_size;
+}
+
+static uint8_t *alloc_slab(size_t size) {
+    void *slab = NULL;
+
+#ifdef _WIN32
+    slab = _aligned_malloc(size, ARENA_SLAB_SIZE);
+#else
+    if (posix_memalign(&slab, ARENA_SLAB_SIZE, size) != 0) slab = NULL;
+
+#ifdef MADV_HUGEPAGE
+    if (slab != NULL) madvise(slab, size, MADV_HUGEPAGE);
+#endif
+#endif
+
+    return (uint8_t*)slab;
+}
+
+static void free_slab(uint8_t *slab) {
+#ifdef _WIN32
+    _aligned_free(slab);
+#else
+    free(slab);
+#endif
+}
+
+// carves a new slab into arenas and puts them on the free list
+static uint8_t add_slab(ArenaPool *pool) {
+    size_t stride = arena_stride(pool);
+    size_t num_arenas = MAX(ARENA_SLAB_SIZE / stride, 1);
+    size_t size = (num_arenas * stride + ARENA_SLAB_SIZE - 1) & ~(size_t)(ARENA_SLAB_SIZE - 1);
+
+    uint8_t *slab = alloc_slab(size);
+
+    if (slab == NULL) {
+        fprintf(stderr, "add_slab(): Failed to allocate %zu bytes.\n", size);
+        return 0;
+    }
+
+    pool->slabs = (uint8_t**)realloc(pool->slabs, (pool->num_slabs + 1) * sizeof(uint8_t*));
+    pool->slabs[pool->num_slabs++] = slab;
+
+    for (size_t a = num_arenas; a-- > 0;) {
+        Arena *arena = (Arena*)(slab + a * stride);
+
+        arena->base = (uint8_t*)arena + ARENA_HEADER_SIZE;
+        arena->pool = pool;
+        arena->next_free = pool->free_arenas;
+
+        pool->free_arenas = arena;
+    }
+
+    return 1;
+}
+
+static void free_arena_pool(ArenaPool *pool) {
+    for (uint32_t s = 0; s < pool->num_slabs; s++) free_slab(pool->slabs[s]);
+
+    free(pool->slabs);
+    free(pool);
+}
+
+// a pool of arenas that can hold 'arena_size' bytes each
+ArenaPool *create_arena_pool(size_t arena_size) {
+    ArenaPool *new_pool = (ArenaPool*)malloc(sizeof(ArenaPool));
+
+    new_pool->arena_size = ARENA_ALIGN_UP(arena_size);
+    new_pool->slabs = NULL;
+    new_pool->num_slabs = 0;
+    new_pool->free_arenas = NULL;
+    new_pool->live = 0;
+    new_pool->closing = 0;
+
+    return new_pool;
+}
+
+// arenas that are still referenced stay valid, the
+// memory goes away when the last one is released
+void destroy_arena_pool(ArenaPool *pool) {
+    if (pool == NULL) return;
+
+    if (pool->live > 0) pool->closing = 1;
+    else free_arena_pool(pool);
+}
+
+// an empty arena with one reference, NULL if there is no memory left
+Arena *arena_acquire(ArenaPool *pool) {
+    if (pool->free_arenas == NULL && add_slab(pool) == 0) return NULL;
+
+    Arena *arena = pool->free_arenas;
+
+    pool->free_arenas = arena->next_free;
+    pool->live++;
+
+    arena->used = 0;
+    arena->refs = 1;
+    arena->next_free = NULL;
+
+    return arena;
+}
+
+Arena *arena_ref(Arena *arena) {
+    arena->refs++;
+    return arena;
+}
+
+void arena_release(Arena *arena) {
+    if (arena == NULL || --arena->refs > 0) return;
+
+    ArenaPool *pool = arena->pool;
+
+    arena->next_free = pool->free_arenas;
+    pool->free_arenas = arena;
+
+    if (--pool->live == 0 && pool->closing) free_arena_pool(pool);
+}
+
+// 'size' zeroed bytes, NULL when the arena is full
+void *arena_alloc(Arena *arena, size_t size) {
+    size = ARENA_ALIGN_UP(size);
+
+    if (arena->used + size > arena->pool->arena_size) {
+        fprintf(stderr, "arena_alloc(): Arena is full.\n");
+        return NULL;
+    }
+
+    uint8_t *ptr = arena->base + arena->used;
+
+    arena->used += size;
+    memset(ptr, 0x00, size);
+
+    return ptr;
+}
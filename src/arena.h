@@ -0,0 +1,59 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Pooled arenas for keeping everything of one GB in a single block.
+//
+// A pool carves equally sized arenas out of slabs that are aligned to
+// huge pages (and advised to use them on Linux). Every allocation in an
+// arena is zeroed and aligned to a cache line. An arena is reference
+// counted, when the last reference goes away it isn't freed but goes
+// back to its pool for the next acquire, so tearing a GB down and
+// creating another one doesn't touch the system allocator. Like
+// SharedBlock this isn't thread safe, use one pool per thread.
+
+#define ARENA_ALIGN     64         // cache line
+#define ARENA_SLAB_SIZE 0x00200000 // huge page
+
+#define ARENA_ALIGN_UP(size) (((size) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+typedef struct Arena {
+    uint8_t *base;
+    size_t used;
+    uint32_t refs;
+
+    struct ArenaPool *pool;
+    struct Arena *next_free;
+} Arena;
+
+typedef struct ArenaPool {
+    // usable bytes of every arena
+    size_t arena_size;
+
+    uint8_t **slabs;
+    uint32_t num_slabs;
+
+    Arena *free_arenas;
+
+    // arenas currently acquired
+    uint32_t live;
+
+    // set by destroy_arena_pool() while arenas were still live
+    uint8_t closing;
+} ArenaPool;
+
+ArenaPool *create_arena_pool(size_t arena_size);
+
+void destroy_arena_pool(ArenaPool *pool);
+
+Arena *arena_acquire(ArenaPool *pool);
+
+Arena *arena_ref(Arena *arena);
+
+void arena_release(Arena *arena);
+
+void *arena_alloc(Arena *arena, size_t size);
+
+#endif
@@ -0,0 +1,79 @@
+#include "audio.h"
+
+#define AUDIO_RING_MASK (AUDIO_RING_FRAMES - 1)
+
+void audio_ring_init(AudioRing *ring) {
+    SDL_SetAtomicInt(&ring->read_pos, 0);
+    SDL_SetAtomicInt(&ring->write_pos, 0);
+    SDL_SetAtomicInt(&ring->underrun_frames, 0);
+    SDL_SetAtomicInt(&ring->dropped_frames, 0);
+
+    ring->last_left = 0;
+    ring->last_right = 0;
+}
+
+uint32_t audio_ring_write(AudioRing *ring, const int16_t *samples, uint32_t frames) {
+    int write_pos = SDL_GetAtomicInt(&ring->write_pos);
+    uint32_t free_frames = AUDIO_RING_FRAMES - (uint32_t)(write_pos - SDL_GetAtomicInt(&ring->read_pos));
+
+    // the producer must never wait, whatever doesn't fit is dropped
+    if (frames > free_frames) {
+        SDL_AddAtomicInt(&ring->dropped_frames, frames - free_frames);
+        frames = free_frames;
+    }
+
+    for (uint32_t f = 0; f < frames; f++) {
+        uint32_t idx = ((uint32_t)write_pos + f) & AUDIO_RING_MASK;
+
+        ring->data[idx * 2] = samples[f * 2];
+        ring->data[idx * 2 + 1] = samples[f * 2 + 1];
+    }
+
+    SDL_MemoryBarrierRelease();
+    SDL_SetAtomicInt(&ring->write_pos, write_pos + frames);
+
+    return frames;
+}
+
+void audio_ring_read(AudioRing *ring, int16_t *out, uint32_t frames) {
+    int read_pos = SDL_GetAtomicInt(&ring->read_pos);
+    uint32_t available = (uint32_t)(SDL_GetAtomicInt(&ring->write_pos) - read_pos);
+
+    SDL_MemoryBarrierAcquire();
+
+    uint32_t f = 0;
+
+    for (; f < frames && f < available; f++) {
+        uint32_t idx = ((uint32_t)read_pos + f) & AUDIO_RING_MASK;
+
+        out[f * 2] = ring->data[idx * 2];
+        out[f * 2 + 1] = ring->data[idx * 2 + 1];
+    }
+
+    SDL_SetAtomicInt(&ring->read_pos, read_pos + f);
+
+    if (f > 0) {
+        ring->last_left = out[(f - 1) * 2];
+        ring->last_right = out[(f - 1) * 2 + 1];
+    }
+
+    if (f == frames) return;
+
+    SDL_AddAtomicInt(&ring->underrun_frames, frames - f);
+
+    // underrun: fade the last sample out instead of
+    // cutting to silence, which would be heard as a click
+    for (uint32_t i = 0; f < frames; f++, i++) {
+        int32_t gain = (i < AUDIO_FADE_FRAMES) ? AUDIO_FADE_FRAMES - i - 1 : 0;
+
+        out[f * 2] = (int16_t)((ring->last_left * gain) / AUDIO_FADE_FRAMES);
+        out[f * 2 + 1] = (int16_t)((ring->last_right * gain) / AUDIO_FADE_FRAMES);
+    }
+
+    ring->last_left = out[(frames - 1) * 2];
+    ring->last_right = out[(frames - 1) * 2 + 1];
+}
+
+uint32_t audio_ring_fill(AudioRing *ring) {
+    return (uint32_t)(SDL_GetAtomicInt(&ring->write_pos) - SDL_GetAtomicInt(&ring->read_pos));
+}
@@ -0,0 +1,44 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include <stdint.h>
+#include <SDL3/SDL.h>
+
+#define AUDIO_RING_FRAMES 8192 // stereo frames, has to be a power of 2
+
+#define AUDIO_SAMPLE_RATE 48000
+#define AUDIO_CLOCK_RATE  1048576 // M-cycles per second
+
+// a bit more than the ~805 stereo frames of one emulated frame
+#define AUDIO_MAX_FRAME_SAMPLES 1024
+
+// how many frames an underrun takes to fade the last sample out
+#define AUDIO_FADE_FRAMES 64
+
+// Lock-free single-producer/single-consumer ring of interleaved
+// int16 stereo samples. The emulation thread writes APU batches,
+// the audio device callback drains them. Neither side ever blocks.
+typedef struct AudioRing {
+    int16_t data[AUDIO_RING_FRAMES * 2];
+
+    SDL_AtomicInt read_pos;
+    SDL_AtomicInt write_pos;
+
+    // telemetry, in stereo frames
+    SDL_AtomicInt underrun_frames;
+    SDL_AtomicInt dropped_frames;
+
+    // owned by the consumer, used to fade out on underruns
+    int16_t last_left;
+    int16_t last_right;
+} AudioRing;
+
+void audio_ring_init(AudioRing *ring);
+
+uint32_t audio_ring_write(AudioRing *ring, const int16_t *samples, uint32_t frames);
+
+void audio_ring_read(AudioRing *ring, int16_t *out, uint32_t frames);
+
+uint32_t audio_ring_fill(AudioRing *ring);
+
+#endif
@@ -0,0 +1,567 @@
+#define _DEFAULT_SOURCE
+
+#include "gb.h"
+#include "env.h"
+#include "factory.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// cart_bench - measures the core without the SDL frontend
+//
+// usage: cart_bench [-f frames] [-s samples] [rom files...]
+//
+// Every benchmark is measured in a number of samples, the results
+// (min/median/p99 of a sample) are printed to stdout as JSON.
+// Without ROM files only the built-in synthetic ROM is run.
+// On Linux the L1 data and last level cache misses per frame of the
+// synthetic ROM are counted as well, when perf events are available.
+
+#define DEFAULT_FRAMES  600
+#define DEFAULT_SAMPLES 101
+
+#define CPU_SAMPLE_STEPS   100000
+#define MMU_SAMPLE_OPS     100000
+#define TIMER_SAMPLE_STEPS 100000
+#define FORK_SAMPLE_FORKS  100
+#define ENV_SAMPLE_STEPS   100
+#define FACTORY_SAMPLE_GBS 10000
+
+#define ENV_STEP_FRAMES 4
+
+#define MMU_ADDR_COUNT 4096
+
+#define WARM_UP_MAX_FRAMES  1000
+#define WARM_UP_GAME_FRAMES 60
+
+typedef struct BenchResult {
+    const char *name;
+    const char *unit;
+    uint32_t samples;
+    double min;
+    double median;
+    double p99;
+} BenchResult;
+
+static const uint8_t HEADER_LOGO[48] = {
+    0xce, 0xed, 0x66, 0x66, 0xcc, 0x0d, 0x00, 0x0b, 0x03, 0x73, 0x00, 0x83, 0x00, 0x0c, 0x00, 0x0d,
+    0x00, 0x08, 0x11, 0x1f, 0x88, 0x89, 0x00, 0x0e, 0xdc, 0xcc, 0x6e, 0xe6, 0xdd, 0xdd, 0xd9, 0x99,
+    0xbb, 0xbb, 0x67, 0x63, 0x6e, 0x0e, 0xec, 0xcc, 0xdd, 0xdc, 0x99, 0x9f, 0xbb, 0xb9, 0x33, 0x3e
+};
+
+// Fills VRAM, the BG map and an OAM DMA source with patterns, turns on
+// the LCD with BG and sprites and then scrolls the BG and runs a DMA
+// (from HRAM) in every VBlank handler while the main loop does ALU work.
+static const uint8_t SYNTHETIC_PROGRAM[] = {
+    0x31, 0xFE, 0xFF,                               // ld sp, $FFFE
+    0x21, 0x00, 0x80,                               // ld hl, $8000
+    0x7D, 0x22, 0x7C, 0xFE, 0x98, 0x20, 0xF9,       // tile data: ld [hl+], l until $9800
+    0x7D, 0x22, 0x7C, 0xFE, 0x9C, 0x20, 0xF9,       // BG map: ld [hl+], l until $9C00
+    0x21, 0x00, 0xC1,                               // ld hl, $C100
+    0x7D, 0x87, 0x22, 0x7D, 0xFE, 0xA0, 0x20, 0xF8, // OAM source: ld [hl+], 2 * l
+    0x21, 0x80, 0xFF, 0x11, 0x00, 0x02, 0x06, 0x0A, // copy the DMA routine to HRAM
+    0x1A, 0x13, 0x22, 0x05, 0x20, 0xFA,
+    0x3E, 0xE4, 0xE0, 0x47, 0xE0, 0x48,             // BGP = OBP0 = $E4
+    0x3E, 0x93, 0xE0, 0x40,                         // LCDC = $93
+    0x3E, 0x01, 0xE0, 0xFF, 0xFB,                   // IE = VBlank, ei
+    0x78, 0x81, 0x04, 0x0D, 0xAA, 0x47, 0x07, 0xCB, // main loop: ALU work
+    0x37, 0x18, 0xF5
+};
+
+static const uint8_t SYNTHETIC_VBLANK_HANDLER[] = {
+    0xCD, 0x80, 0xFF,                               // call $FF80 (DMA)
+    0xF0, 0x43, 0x3C, 0xE0, 0x43,                   // SCX++
+    0xD9                                            // reti
+};
+
+static const uint8_t SYNTHETIC_DMA_ROUTINE[] = {
+    0x3E, 0xC1, 0xE0, 0x46,                         // DMA from $C100
+    0x3E, 0x28, 0x3D, 0x20, 0xFD,                   // wait 160 M-cycles
+    0xC9                                            // ret
+};
+
+// an instruction mix that only touches registers, WRAM and HRAM,
+// executed from WRAM by the CPU microbenchmark
+static const uint8_t CPU_STREAM[] = {
+    0x78,             // ld a, b
+    0x81,             // add a, c
+    0x04,             // inc b
+    0x0D,             // dec c
+    0xAA,             // xor d
+    0x77,             // ld [hl], a
+    0x7E,             // ld a, [hl]
+    0xBB,             // cp e
+    0x07,             // rlca
+    0xCB, 0x37,       // swap a
+    0x23,             // inc hl
+    0xE0, 0x90,       // ldh [$90], a
+    0xF0, 0x90,       // ldh a, [$90]
+    0xC5,             // push bc
+    0xC1,             // pop bc
+    0x20, 0x02,       // jr nz, +2
+    0x00, 0x00,       // nop, nop
+    0x18, 0xE8        // jr (back to the start)
+};
+
+static uint8_t *create_synthetic_rom(void) {
+    uint8_t *rom = (uint8_t*)malloc(KIB_32);
+
+    memset(rom, 0x00, KIB_32);
+
+    memcpy(rom + 0x0040, SYNTHETIC_VBLANK_HANDLER, sizeof(SYNTHETIC_VBLANK_HANDLER));
+
+    // entry point: nop, jp $0150
+    rom[0x0100] = 0x00;
+    rom[0x0101] = 0xC3;
+    rom[0x0102] = 0x50;
+    rom[0x0103] = 0x01;
+
+    memcpy(rom + 0x0104, HEADER_LOGO, sizeof(HEADER_LOGO));
+    memcpy(rom + 0x0134, "CARTBENCH", 9);
+
+    // the boot ROM locks up on a wrong header checksum
+    uint8_t checksum = 0;
+    for (uint16_t a = 0x0134; a < 0x014D; a++) checksum = checksum - rom[a] - 1;
+    rom[0x014D] = checksum;
+
+    memcpy(rom + 0x0150, SYNTHETIC_PROGRAM, sizeof(SYNTHETIC_PROGRAM));
+    memcpy(rom + 0x0200, SYNTHETIC_DMA_ROUTINE, sizeof(SYNTHETIC_DMA_ROUTINE));
+
+    return rom;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+
+    return (x > y) - (x < y);
+}
+
+static BenchResult summarize(const char *name, const char *unit, double *samples, uint32_t count) {
+    qsort(samples, count, sizeof(double), compare_doubles);
+
+    uint32_t p99_idx = (uint32_t)((count - 1) * 0.99 + 0.5);
+
+    return (BenchResult){
+        .name = name,
+        .unit = unit,
+        .samples = count,
+        .min = samples[0],
+        .median = samples[count / 2],
+        .p99 = samples[p99_idx]
+    };
+}
+
+// runs the boot ROM and a few frames of the game, so that
+// only the game itself is measured
+static void warm_up(GB *gb) {
+    for (uint32_t f = 0; f < WARM_UP_MAX_FRAMES && gb->mmu.bootrom_mapped == 1; f++)
+        gb_run_frame(gb);
+
+    for (uint32_t f = 0; f < WARM_UP_GAME_FRAMES; f++) gb_run_frame(gb);
+}
+
+static BenchResult bench_frames(const char *name, GB *gb, uint32_t frames) {
+    double *samples = (double*)malloc(frames * sizeof(double));
+
+    for (uint32_t f = 0; f < frames; f++) {
+        uint64_t start = get_time_ns();
+        gb_run_frame(gb);
+        samples[f] = (double)(get_time_ns() - start) / 1000.0;
+    }
+
+    BenchResult res = summarize(name, "us/frame", samples, frames);
+
+    free(samples);
+    return res;
+}
+
+#ifdef __linux__
+
+static int open_cache_counter(uint64_t cache) {
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+// read misses of 'cache' (a PERF_COUNT_HW_CACHE_* id) in every frame,
+// returns 0 when the counter can't be opened, e.g. in a VM
+static uint8_t bench_frame_misses(BenchResult *res, const char *name, GB *gb, uint32_t frames, uint64_t cache) {
+    int fd = open_cache_counter(cache);
+
+    if (fd < 0) return 0;
+
+    double *samples = (double*)malloc(frames * sizeof(double));
+
+    for (uint32_t f = 0; f < frames; f++) {
+        uint64_t misses = 0;
+
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        gb_run_frame(gb);
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+
+        if (read(fd, &misses, sizeof(misses)) != sizeof(misses)) misses = 0;
+
+        samples[f] = (double)misses;
+    }
+
+    close(fd);
+
+    *res = summarize(name, "misses/frame", samples, frames);
+
+    free(samples);
+    return 1;
+}
+
+#endif
+
+static BenchResult bench_cpu(GB *gb, uint32_t sample_count) {
+    double *samples = (double*)malloc(sample_count * sizeof(double));
+
+    for (uint16_t b = 0; b < sizeof(CPU_STREAM); b++)
+        gb->wram[b] = CPU_STREAM[b];
+
+    gb->mmu.bootrom_mapped = 0;
+    gb->cpu.pc = WRAM_BASE_ADDR;
+    gb->cpu.sp = 0xDFF0;
+    gb->cpu.ime = 0;
+    gb->cpu.ime_set_pending = 0;
+    gb->cpu.halted = 0;
+    write_r16(&gb->cpu, REG16_HL, 0xD000);
+
+    for (uint32_t s = 0; s < sample_count; s++) {
+        uint64_t start = get_time_ns();
+
+        for (uint32_t i = 0; i < CPU_SAMPLE_STEPS; i++) {
+            cpu_step(&gb->cpu);
+
+            // keeps [hl] inside WRAM
+            if (gb->cpu.h > 0xDE) gb->cpu.h = 0xD0;
+        }
+
+        samples[s] = (double)(get_time_ns() - start) / CPU_SAMPLE_STEPS;
+    }
+
+    BenchResult res = summarize("cpu_step/stream", "ns/instr", samples, sample_count);
+
+    free(samples);
+    return res;
+}
+
+static uint16_t random_addr(uint32_t *seed, uint8_t writable) {
+    *seed = *seed * 1103515245u + 12345u;
+    uint16_t r = (uint16_t)(*seed >> 8);
+
+    // read mix: ROM, VRAM, WRAM, OAM, IO and HRAM; write mix leaves out
+    // ROM (MBC registers) and IO (side effects like DMA or DIV reset)
+    switch ((*seed >> 24) % (writable ? 4 : 6)) {
+        case 0: return WRAM_BASE_ADDR + (r % WRAM_SIZE);
+        case 1: return VRAM_BASE_ADDR + (r % VRAM_SIZE);
+        case 2: return HRAM_BASE_ADDR + (r % HRAM_SIZE);
+        case 3: return OAM_BASE_ADDR + (r % OAM_SIZE);
+        case 4: return r % 0x8000;
+        default: return IO_BASE_ADDR + (r % IO_SIZE);
+    }
+}
+
+static BenchResult bench_mmu(GB *gb, uint32_t sample_count) {
+    double *samples = (double*)malloc(sample_count * sizeof(double));
+
+    uint16_t read_addrs[MMU_ADDR_COUNT];
+    uint16_t write_addrs[MMU_ADDR_COUNT];
+    uint32_t seed = 1;
+
+    for (uint16_t i = 0; i < MMU_ADDR_COUNT; i++) {
+        read_addrs[i] = random_addr(&seed, 0);
+        write_addrs[i] = random_addr(&seed, 1);
+    }
+
+    volatile uint8_t sink = 0;
+
+    for (uint32_t s = 0; s < sample_count; s++) {
+        uint64_t start = get_time_ns();
+
+        // three reads for every write, roughly what games do
+        for (uint32_t i = 0; i < MMU_SAMPLE_OPS; i += 4) {
+            uint16_t idx = i % MMU_ADDR_COUNT;
+
+            uint8_t val = mmu_read(&gb->mmu, read_addrs[idx]);
+            val += mmu_read(&gb->mmu, read_addrs[idx + 1]);
+            val += mmu_read(&gb->mmu, read_addrs[idx + 2]);
+            mmu_write(&gb->mmu, write_addrs[idx], val);
+
+            sink = val;
+        }
+
+        samples[s] = (double)(get_time_ns() - start) / MMU_SAMPLE_OPS;
+    }
+
+    (void)sink;
+
+    BenchResult res = summarize("mmu_read_write/mix", "ns/access", samples, sample_count);
+
+    free(samples);
+    return res;
+}
+
+// 'timed' draws every line with a palette write in the middle of it
+static BenchResult bench_ppu(GB *gb, uint32_t sample_count, uint8_t timed) {
+    double *samples = (double*)malloc(sample_count * sizeof(double));
+
+    // renders whatever VRAM/OAM state the GB is in
+    PPU ppu = gb->ppu;
+    uint8_t lcdc = gb->io[LCDC_ADDR_RELATIVE] | LCDC_BG_WIND_ENABLE_MASK | LCDC_OBJ_ENABLE_MASK;
+
+    memcpy(gb->line_log.start_regs, &gb->io[LCDC_ADDR_RELATIVE], PPU_REGS);
+    gb->line_log.start_regs[0] = lcdc;
+    gb->line_log.writes[0] = (PPULineWrite){ PIXEL_DRAW_DOTS / 2, BGP_ADDR_RELATIVE - LCDC_ADDR_RELATIVE, (uint8_t)~gb->io[BGP_ADDR_RELATIVE] };
+
+    for (uint32_t s = 0; s < sample_count; s++) {
+        uint64_t start = get_time_ns();
+
+        for (uint8_t line = 0; line < GB_SCREEN_H; line++) {
+            ppu.current_line = line;
+            ppu_scan_oam(&ppu, lcdc);
+
+            if (timed) {
+                ppu.num_line_writes = 1;
+                ppu_draw_scanline_timed(&ppu);
+            } else {
+                ppu_draw_scanline(&ppu, lcdc);
+            }
+        }
+
+        samples[s] = (double)(get_time_ns() - start) / GB_SCREEN_H;
+    }
+
+    BenchResult res = summarize(timed ? "ppu_draw_scanline_timed/captured" : "ppu_draw_scanline/captured", "ns/line", samples, sample_count);
+
+    free(samples);
+    return res;
+}
+
+static BenchResult bench_timer(GB *gb, uint32_t sample_count) {
+    double *samples = (double*)malloc(sample_count * sizeof(double));
+
+    gb->io[TAC_ADDR_RELATIVE] = TAC_ENABLE_MASK | TIMER_CLOCK_16;
+
+    for (uint32_t s = 0; s < sample_count; s++) {
+        uint64_t start = get_time_ns();
+
+        for (uint32_t i = 0; i < TIMER_SAMPLE_STEPS; i++)
+            timer_step(&gb->timer, 4);
+
+        samples[s] = (double)(get_time_ns() - start) / TIMER_SAMPLE_STEPS;
+    }
+
+    BenchResult res = summarize("timer_step/4_cycles", "ns/step", samples, sample_count);
+
+    free(samples);
+    return res;
+}
+
+static BenchResult bench_fork(GB *gb, uint32_t sample_count) {
+    double *samples = (double*)malloc(sample_count * sizeof(double));
+    GB *pool[FORK_SAMPLE_FORKS];
+
+    for (uint32_t i = 0; i < FORK_SAMPLE_FORKS; i++) pool[i] = gb_fork(gb);
+
+    // forks are recycled like an exploration pool would, each one
+    // running a frame without drawing so that it writes some memory
+    for (uint32_t s = 0; s < sample_count; s++) {
+        uint64_t start = get_time_ns();
+
+        for (uint32_t i = 0; i < FORK_SAMPLE_FORKS; i++) {
+            gb_fork_into(gb, pool[i]);
+            ppu_set_render_enable(&pool[i]->ppu, 0);
+            gb_run_frame(pool[i]);
+        }
+
+        samples[s] = (double)(get_time_ns() - start) / 1000.0 / FORK_SAMPLE_FORKS;
+    }
+
+    for (uint32_t i = 0; i < FORK_SAMPLE_FORKS; i++) destroy_gb(pool[i]);
+
+    BenchResult res = summarize("gb_fork/frame", "us/fork", samples, sample_count);
+
+    free(samples);
+    return res;
+}
+
+static BenchResult bench_env(uint32_t sample_count) {
+    double *samples = (double*)malloc(sample_count * sizeof(double));
+    Env *env = create_env(create_gb_from_rom(create_synthetic_rom()), 1, 0);
+
+    // an episode of ENV_SAMPLE_STEPS steps with a downsampled observation each
+    for (uint32_t s = 0; s < sample_count; s++) {
+        uint64_t start = get_time_ns();
+
+        env_reset(env);
+
+        for (uint32_t i = 0; i < ENV_SAMPLE_STEPS; i++) {
+            env_step(env, (uint8_t)(i * 37), ENV_STEP_FRAMES);
+            env_observation(env, 2);
+        }
+
+        samples[s] = (double)(get_time_ns() - start) / 1000.0 / ENV_SAMPLE_STEPS;
+    }
+
+    destroy_env(env);
+
+    BenchResult res = summarize("env_step/4_frames", "us/step", samples, sample_count);
+
+    free(samples);
+    return res;
+}
+
+// instances are either forks or clones in arenas, see factory_clone()
+static BenchResult bench_factory(uint32_t sample_count, uint8_t clone) {
+    double *samples = (double*)malloc(sample_count * sizeof(double));
+    GB **gbs = (GB**)malloc(FACTORY_SAMPLE_GBS * sizeof(GB*));
+    Factory *factory = create_factory_from_gb(create_gb_from_rom(create_synthetic_rom()), 0);
+
+    // spawning and discarding a whole population of instances
+    for (uint32_t s = 0; s < sample_count; s++) {
+        uint64_t start = get_time_ns();
+
+        if (clone) for (uint32_t i = 0; i < FACTORY_SAMPLE_GBS; i++) gbs[i] = factory_clone(factory);
+        else factory_spawn_many(factory, gbs, FACTORY_SAMPLE_GBS);
+
+        for (uint32_t i = 0; i < FACTORY_SAMPLE_GBS; i++) destroy_gb(gbs[i]);
+
+        samples[s] = (double)(get_time_ns() - start) / FACTORY_SAMPLE_GBS;
+    }
+
+    destroy_factory(factory);
+    free(gbs);
+
+    BenchResult res = summarize(clone ? "factory_clone/10000" : "factory_spawn/10000", "ns/instance", samples, sample_count);
+
+    free(samples);
+    return res;
+}
+
+static void print_result(const BenchResult *res, const char *rom, uint8_t last) {
+    printf("    {\"name\": \"%s\", ", res->name);
+
+    if (rom != NULL) printf("\"rom\": \"%s\", ", rom);
+
+    printf(
+            "\"unit\": \"%s\", \"samples\": %u, \"min\": %.3f, \"median\": %.3f, \"p99\": %.3f}%s\n",
+            res->unit,
+            res->samples,
+            res->min,
+            res->median,
+            res->p99,
+            last ? "" : ","
+    );
+
+    fprintf(stderr, "%-28s %-12s min %10.3f  median %10.3f  p99 %10.3f  %s\n",
+            res->name, res->unit, res->min, res->median, res->p99, rom ? rom : "");
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t frames = DEFAULT_FRAMES;
+    uint32_t sample_count = DEFAULT_SAMPLES;
+
+    int first_rom = 1;
+
+    for (; first_rom < argc; first_rom++) {
+        if (strcmp(argv[first_rom], "-f") == 0 && first_rom + 1 < argc)
+            frames = (uint32_t)atoi(argv[++first_rom]);
+        else if (strcmp(argv[first_rom], "-s") == 0 && first_rom + 1 < argc)
+            sample_count = (uint32_t)atoi(argv[++first_rom]);
+        else
+            break;
+    }
+
+    if (frames == 0 || sample_count == 0) {
+        fprintf(stderr, "usage: %s [-f frames] [-s samples] [rom files...]\n", argv[0]);
+        return -1;
+    }
+
+    printf("{\n  \"benchmarks\": [\n");
+
+    // whole system: the synthetic ROM and every ROM given
+    GB *gb = create_gb_from_rom(create_synthetic_rom());
+    warm_up(gb);
+
+    BenchResult res = bench_frames("frame/synthetic", gb, frames);
+    print_result(&res, NULL, 0);
+
+#ifdef __linux__
+    if (bench_frame_misses(&res, "cache/l1d", gb, frames, PERF_COUNT_HW_CACHE_L1D))
+        print_result(&res, NULL, 0);
+    else
+        fprintf(stderr, "cart_bench: Cache miss counters aren't available.\n");
+
+    if (bench_frame_misses(&res, "cache/llc", gb, frames, PERF_COUNT_HW_CACHE_LL))
+        print_result(&res, NULL, 0);
+#endif
+
+    for (int r = first_rom; r < argc; r++) {
+        GB *rom_gb = create_gb(argv[r]);
+
+        if (rom_gb == NULL) {
+            fprintf(stderr, "cart_bench: Failed to load ROM: %s\n", argv[r]);
+            continue;
+        }
+
+        warm_up(rom_gb);
+
+        res = bench_frames("frame/rom", rom_gb, frames);
+        print_result(&res, argv[r], 0);
+
+        destroy_gb(rom_gb);
+    }
+
+    // subsystem microbenchmarks, on the state the synthetic ROM has set up
+    res = bench_fork(gb, sample_count);
+    print_result(&res, NULL, 0);
+
+    res = bench_env(sample_count);
+    print_result(&res, NULL, 0);
+
+    res = bench_factory(sample_count, 0);
+    print_result(&res, NULL, 0);
+
+    res = bench_factory(sample_count, 1);
+    print_result(&res, NULL, 0);
+
+    res = bench_ppu(gb, sample_count, 0);
+    print_result(&res, NULL, 0);
+
+    res = bench_ppu(gb, sample_count, 1);
+    print_result(&res, NULL, 0);
+
+    res = bench_mmu(gb, sample_count);
+    print_result(&res, NULL, 0);
+
+    res = bench_timer(gb, sample_count);
+    print_result(&res, NULL, 0);
+
+    res = bench_cpu(gb, sample_count);
+    print_result(&res, NULL, 1);
+
+    printf("  ]\n}\n");
+
+    destroy_gb(gb);
+    return 0;
+}
@@ -2,23 +2,167 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "util.h"
+#include "profiler.h"
+#include "trace.h"
+#include "stats.h"
+#include "movie.h"
 
 extern uint8_t print_debug;
 
 #define MS_PER_FRAME 17 // while running 59 FPS
 
+#define TRACE_RECORDS (1 << 20)
+#define STATS_FRAMES 3600 // one minute
+
+// set in middle_frame when it holds a frame the render thread hasn't shown yet
+#define FRAME_FRESH_FLAG 0x04
+#define FRAME_INDEX_MASK 0x03
+
+static const uint8_t DEFAULT_PALETTE[4][3] = {
+    {255, 255, 255},
+    {170, 170, 170},
+    { 85,  85,  85},
+    {  0,   0,   0}
+};
+
 static void cart_save_game(Emulator *emu) {
     if (emu->gb->cartridge->ram_size > 0) {
         write_bytes_to_file("saved_state.bin", emu->gb->cartridge->ram, emu->gb->cartridge->ram_size);
     }
 }
 
+#ifdef CART_PROFILER
+static void cart_write_profile(Profiler *profiler) {
+    FILE *report = fopen("profile.txt", "w");
+    FILE *folded = fopen("profile.folded", "w");
+
+    if (report == NULL || folded == NULL)
+        fprintf(stderr, "cart_write_profile(): Failed to open the profile files.\n");
+
+    if (report != NULL) {
+        profiler_write_report(profiler, report, 100);
+        fclose(report);
+    }
+
+    if (folded != NULL) {
+        profiler_write_folded(profiler, folded);
+        fclose(folded);
+    }
+}
+#endif
+
+#ifdef CART_STATS
+static void cart_write_stats(Stats *stats, const char *filename) {
+    FILE *file = fopen(filename, "w");
+
+    if (file == NULL) {
+        fprintf(stderr, "cart_write_stats(): Failed to open file: %s\n", filename);
+        return;
+    }
+
+    stats_write_csv(stats, file);
+    fclose(file);
+}
+#endif
+
+// emulation thread side of the frame handoff
+static void cart_publish_frame(Emulator *emu) {
+    memcpy(emu->frames[emu->back_frame], emu->gb->framebuffer, GB_SCREEN_W * GB_SCREEN_H);
+
+    emu->back_frame = SDL_SetAtomicInt(&emu->middle_frame, emu->back_frame | FRAME_FRESH_FLAG)
+        & FRAME_INDEX_MASK;
+}
+
+// render thread side of the frame handoff
+static uint8_t cart_acquire_frame(Emulator *emu) {
+    if ((SDL_GetAtomicInt(&emu->middle_frame) & FRAME_FRESH_FLAG) == 0) return 0;
+
+    emu->front_frame = SDL_SetAtomicInt(&emu->middle_frame, emu->front_frame)
+        & FRAME_INDEX_MASK;
+
+    return 1;
+}
+
+static void cart_audio_callback(void *userdata, SDL_AudioStream *stream, int additional_amount, int total_amount) {
+    Emulator *emu = (Emulator*)userdata;
+
+    int16_t samples[512 * 2];
+    int frames = additional_amount / (int)(sizeof(int16_t) * 2);
+
+    while (frames > 0) {
+        int chunk = MIN(frames, 512);
+
+        audio_ring_read(&emu->audio_ring, samples, chunk);
+        SDL_PutAudioStreamData(stream, samples, chunk * sizeof(int16_t) * 2);
+
+        frames -= chunk;
+    }
+}
+
+// keeps the device fed at the emulated rate
+static void cart_queue_audio(Emulator *emu) {
+    emu->audio_sample_counter += (uint64_t)GB_CYCLES_PER_FRAME * AUDIO_SAMPLE_RATE;
+
+    uint32_t frames = (uint32_t)MIN(emu->audio_sample_counter / AUDIO_CLOCK_RATE, AUDIO_MAX_FRAME_SAMPLES);
+
+    emu->audio_sample_counter %= AUDIO_CLOCK_RATE;
+
+    audio_ring_write(&emu->audio_ring, emu->audio_samples, frames);
+}
+
+static void cart_apply_input(Emulator *emu, InputEvent event) {
+    switch (event.type) {
+        case INPUT_EVENT_JOYPAD:
+            joypad_set(&emu->gb->joypad, event.data); break;
+        case INPUT_EVENT_SAVE:
+            cart_save_game(emu); break;
+    }
+}
+
+static int cart_emulation_thread(void *data) {
+    Emulator *emu = (Emulator*)data;
+
+    uint64_t current_frame_time = 0;
+    uint64_t last_frame_time = 0;
+
+    InputEvent event;
+
+    while (SDL_GetAtomicInt(&emu->running) == 1) {
+        // input is only applied between whole frames, which keeps runs reproducible
+        gb_run_frame(emu->gb);
+
+        if (emu->movie != NULL) movie_record_frame(emu->movie, emu->gb);
+
+        cart_publish_frame(emu);
+
+        if (emu->audio_stream != NULL) cart_queue_audio(emu);
+
+        while (input_queue_pop(&emu->input_queue, &event)) cart_apply_input(emu, event);
+
+        current_frame_time = SDL_GetTicks();
+
+        uint32_t frame_delay = current_frame_time - last_frame_time;
+
+        last_frame_time = current_frame_time;
+
+        if (frame_delay < MS_PER_FRAME) SDL_Delay(MS_PER_FRAME - frame_delay);
+    }
+
+    return 0;
+}
+
 Emulator *create_emulator() {
     Emulator *new_emu = (Emulator*)malloc(sizeof(Emulator));
 
-    if (SDL_Init(SDL_INIT_VIDEO) == 0) {
+    new_emu->audio_stream = NULL;
+    new_emu->stats = NULL;
+    new_emu->movie = NULL;
+    new_emu->serial_capture = NULL;
+
+    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) == 0) {
         fprintf(stderr, "create_emulator(): Failed to initialize SDL.\n");
         destroy_emulator(new_emu);
         return NULL;
@@ -40,6 +184,9 @@ Emulator *create_emulator() {
         return NULL;
     }
 
+    // presenting is paced by the display, emulation by its own thread
+    SDL_SetRenderVSync(new_emu->renderer, 1);
+
     new_emu->screen_texture = SDL_CreateTexture(
             new_emu->renderer,
             SDL_GetWindowPixelFormat(new_emu->window),
@@ -54,25 +201,118 @@ Emulator *create_emulator() {
         return NULL;
     }
 
-    // TODO -> AudioStream creation
+    cart_set_palette(new_emu, DEFAULT_PALETTE);
+
+    audio_ring_init(&new_emu->audio_ring);
+
+    memset(new_emu->audio_samples, 0, sizeof(new_emu->audio_samples));
+    new_emu->audio_sample_counter = 0;
+
+    SDL_AudioSpec audio_spec = { SDL_AUDIO_S16, 2, AUDIO_SAMPLE_RATE };
+
+    new_emu->audio_stream = SDL_OpenAudioDeviceStream(
+            SDL_AUDIO_DEVICE_DEFAULT_PLAYBACK,
+            &audio_spec,
+            cart_audio_callback,
+            new_emu
+    );
+
+    // running without sound is better than not running at all
+    if (new_emu->audio_stream == NULL)
+        fprintf(stderr, "create_emulator(): Failed to open an audio stream.\n");
+    else
+        SDL_ResumeAudioStreamDevice(new_emu->audio_stream);
 
     new_emu->keys = SDL_GetKeyboardState(NULL);
 
     new_emu->should_close = 0;
 
+    new_emu->emu_thread = NULL;
+    SDL_SetAtomicInt(&new_emu->running, 0);
+
+    memset(new_emu->frames, 0x00, sizeof(new_emu->frames));
+    new_emu->back_frame = 0;
+    SDL_SetAtomicInt(&new_emu->middle_frame, 1);
+    new_emu->front_frame = 2;
+
+    SDL_SetAtomicInt(&new_emu->input_queue.head, 0);
+    SDL_SetAtomicInt(&new_emu->input_queue.tail, 0);
+    new_emu->joypad_state = 0x00;
+
     new_emu->gb = create_gb("test3.gb");
 
+    // starts the cartridge right away, without the logo scroll
+    if (new_emu->gb != NULL && getenv("CART_SKIP_BOOT") != NULL)
+        gb_skip_boot(new_emu->gb);
+
+#ifdef CART_PROFILER
+    // the profiler is compiled in, but only runs when asked for
+    if (new_emu->gb != NULL && getenv("CART_PROFILE") != NULL)
+        new_emu->gb->profiler = create_profiler();
+#endif
+
+#ifdef CART_TRACE
+    if (new_emu->gb != NULL && getenv("CART_TRACE") != NULL)
+        new_emu->gb->trace = create_trace(TRACE_RECORDS);
+#endif
+
+    if (new_emu->gb != NULL && getenv("CART_SERIAL") != NULL) {
+        new_emu->serial_capture = create_serial_capture("serial.txt");
+        serial_set_exchange(&new_emu->gb->serial, serial_capture_exchange, new_emu->serial_capture);
+    }
+
+    if (new_emu->gb != NULL && getenv("CART_RECORD") != NULL)
+        new_emu->movie = create_movie(new_emu->gb, MOVIE_CHECKPOINT_FRAMES);
+
+#ifdef CART_STATS
+    // the frontend keeps its own counters, as it runs on another thread
+    if (new_emu->gb != NULL && getenv("CART_STATS") != NULL) {
+        new_emu->gb->stats = create_stats(STATS_FRAMES);
+        new_emu->stats = create_stats(STATS_FRAMES);
+    }
+#endif
+
     return new_emu;
 }
 
 void destroy_emulator(Emulator *emu) {
     if (emu == NULL) return;
 
-    //SDL_DestroyAudioStream(emu->audio_stream);
+    SDL_DestroyAudioStream(emu->audio_stream);
     SDL_DestroyTexture(emu->screen_texture);
     SDL_DestroyRenderer(emu->renderer);
     SDL_DestroyWindow(emu->window);
     SDL_Quit();
+
+#ifdef CART_PROFILER
+    if (emu->gb != NULL && emu->gb->profiler != NULL) {
+        cart_write_profile(emu->gb->profiler);
+        destroy_profiler(emu->gb->profiler);
+    }
+#endif
+
+#ifdef CART_TRACE
+    if (emu->gb != NULL && emu->gb->trace != NULL) {
+        trace_write(emu->gb->trace, "trace.bin");
+        destroy_trace(emu->gb->trace);
+    }
+#endif
+
+    destroy_serial_capture(emu->serial_capture);
+
+    if (emu->movie != NULL) {
+        movie_write(emu->movie, "movie.cmv");
+        destroy_movie(emu->movie);
+    }
+
+#ifdef CART_STATS
+    if (emu->gb != NULL && emu->gb->stats != NULL) {
+        cart_write_stats(emu->gb->stats, "stats_core.csv");
+        cart_write_stats(emu->stats, "stats_frontend.csv");
+        destroy_stats(emu->gb->stats);
+        destroy_stats(emu->stats);
+    }
+#endif
     
     destroy_gb(emu->gb);
 
@@ -84,33 +324,28 @@ uint8_t cart_run() {
 
     if (emulator == NULL) return 0;
 
-    uint64_t current_frame_time = 0;
-    uint64_t last_frame_time = 0;
+    if (emulator->gb != NULL) {
+        SDL_SetAtomicInt(&emulator->running, 1);
+        emulator->emu_thread = SDL_CreateThread(cart_emulation_thread, "emulation", emulator);
+
+        if (emulator->emu_thread == NULL) {
+            fprintf(stderr, "cart_run(): Failed to create the emulation thread.\n");
+            destroy_emulator(emulator);
+            return 0;
+        }
+    }
 
-    uint32_t counter = 0;
-    
     // Main event loop
     while (emulator->should_close == 0) {
         while (SDL_PollEvent(&emulator->event)) cart_handle_events(emulator);
 
-        if (emulator->gb == NULL) continue;
-
-        gb_step(emulator->gb);
-
-        if (emulator->gb->frame_ready == 1) {
-            cart_render(emulator);
-
-            current_frame_time = SDL_GetTicks();
-
-            uint32_t frame_delay = current_frame_time - last_frame_time;
-
-            last_frame_time = current_frame_time;
-            
-            if (frame_delay < MS_PER_FRAME) SDL_Delay(MS_PER_FRAME - frame_delay);
-        }
-
+        if (cart_acquire_frame(emulator) == 1) cart_render(emulator);
+        else SDL_Delay(1);
     }
 
+    SDL_SetAtomicInt(&emulator->running, 0);
+    SDL_WaitThread(emulator->emu_thread, NULL);
+
     destroy_emulator(emulator);
     return 1;
 }
@@ -122,50 +357,91 @@ void cart_handle_events(Emulator *emu) {
 
     if (emu->gb == NULL) return;
 
-    joypad_reset(&emu->gb->joypad);
+    uint8_t state = 0x00;
 
-    if (emu->keys[SDL_SCANCODE_Z]) joypad_press(&emu->gb->joypad, JOYPAD_BUTTON_B);
-    if (emu->keys[SDL_SCANCODE_X]) joypad_press(&emu->gb->joypad, JOYPAD_BUTTON_A);
-    if (emu->keys[SDL_SCANCODE_C]) joypad_press(&emu->gb->joypad, JOYPAD_BUTTON_START);
-    if (emu->keys[SDL_SCANCODE_V]) joypad_press(&emu->gb->joypad, JOYPAD_BUTTON_SELECT);
-    if (emu->keys[SDL_SCANCODE_RIGHT]) joypad_press(&emu->gb->joypad, JOYPAD_BUTTON_RIGHT);
-    if (emu->keys[SDL_SCANCODE_LEFT]) joypad_press(&emu->gb->joypad, JOYPAD_BUTTON_LEFT);
-    if (emu->keys[SDL_SCANCODE_UP]) joypad_press(&emu->gb->joypad, JOYPAD_BUTTON_UP);
-    if (emu->keys[SDL_SCANCODE_DOWN]) joypad_press(&emu->gb->joypad, JOYPAD_BUTTON_DOWN);
+    if (emu->keys[SDL_SCANCODE_Z]) state |= 1 << JOYPAD_BUTTON_B;
+    if (emu->keys[SDL_SCANCODE_X]) state |= 1 << JOYPAD_BUTTON_A;
+    if (emu->keys[SDL_SCANCODE_C]) state |= 1 << JOYPAD_BUTTON_START;
+    if (emu->keys[SDL_SCANCODE_V]) state |= 1 << JOYPAD_BUTTON_SELECT;
+    if (emu->keys[SDL_SCANCODE_RIGHT]) state |= 1 << JOYPAD_BUTTON_RIGHT;
+    if (emu->keys[SDL_SCANCODE_LEFT]) state |= 1 << JOYPAD_BUTTON_LEFT;
+    if (emu->keys[SDL_SCANCODE_UP]) state |= 1 << JOYPAD_BUTTON_UP;
+    if (emu->keys[SDL_SCANCODE_DOWN]) state |= 1 << JOYPAD_BUTTON_DOWN;
 
-    if (emu->keys[SDL_SCANCODE_LCTRL] && emu->keys[SDL_SCANCODE_S]) cart_save_game(emu);
+    // the emulation thread owns the GB, so input is only handed over
+    if (state != emu->joypad_state &&
+        input_queue_push(&emu->input_queue, (InputEvent){ INPUT_EVENT_JOYPAD, state }) == 1)
+        emu->joypad_state = state;
+
+    if (emu->keys[SDL_SCANCODE_LCTRL] && emu->keys[SDL_SCANCODE_S])
+        input_queue_push(&emu->input_queue, (InputEvent){ INPUT_EVENT_SAVE, 0 });
 }
 
 void cart_render(Emulator *emu) {
     void *pixels = NULL;
     int pitch = 0;
 
+    STATS_BEGIN(emu->stats);
+
     SDL_LockTexture(emu->screen_texture, NULL, &pixels, &pitch);
 
-    Uint32 *pixels_dest = (Uint32*)pixels;
+    const uint8_t *src = emu->frames[emu->front_frame];
+    const Uint32 *palette = emu->palette;
 
-    const SDL_PixelFormatDetails *format=
-        SDL_GetPixelFormatDetails(SDL_GetWindowPixelFormat(emu->window));
+    // the framebuffer holds shade indices only, so converting
+    // it is a plain table lookup per pixel
+    for (uint8_t y = 0; y < GB_SCREEN_H; y++) {
+        Uint32 *dest = (Uint32*)((uint8_t*)pixels + y * pitch);
 
-    for (uint16_t p = 0; p < (GB_SCREEN_W * GB_SCREEN_H); p++) {
-        switch (emu->gb->framebuffer[p]) {
-            case 0:
-                pixels_dest[p] = SDL_MapRGB(format, NULL, 255, 255, 255); break;
-            case 1:
-                pixels_dest[p] = SDL_MapRGB(format, NULL, 170, 170, 170); break;
-            case 2:
-                pixels_dest[p] = SDL_MapRGB(format, NULL, 85, 85, 85); break;
-            case 3:
-                pixels_dest[p] = SDL_MapRGB(format, NULL, 0, 0, 0); break;
-        }
-    }
+        for (uint8_t x = 0; x < GB_SCREEN_W; x++)
+            dest[x] = palette[src[x] & 0x03];
 
-    emu->gb->frame_ready = 0;
+        src += GB_SCREEN_W;
+    }
 
     SDL_UnlockTexture(emu->screen_texture);
+    STATS_LAP(emu->stats, STATS_TIMER_CONVERT);
 
     SDL_SetRenderDrawColor(emu->renderer, 255, 255, 0, 255);
     SDL_RenderClear(emu->renderer);
     SDL_RenderTexture(emu->renderer, emu->screen_texture, NULL, NULL);
     SDL_RenderPresent(emu->renderer);
-}
\ No newline at end of file
+    STATS_LAP(emu->stats, STATS_TIMER_PRESENT);
+
+    STATS_END_FRAME(emu->stats);
+}
+
+void cart_set_palette(Emulator *emu, const uint8_t colors[4][3]) {
+    const SDL_PixelFormatDetails *format =
+        SDL_GetPixelFormatDetails(SDL_GetWindowPixelFormat(emu->window));
+
+    for (uint8_t c = 0; c < 4; c++)
+        emu->palette[c] = SDL_MapRGB(format, NULL, colors[c][0], colors[c][1], colors[c][2]);
+}
+
+uint8_t input_queue_push(InputQueue *queue, InputEvent event) {
+    int tail = SDL_GetAtomicInt(&queue->tail);
+
+    if (tail - SDL_GetAtomicInt(&queue->head) == INPUT_QUEUE_SIZE) return 0; // full
+
+    queue->events[tail & (INPUT_QUEUE_SIZE - 1)] = event;
+
+    // publish the event only after it has been written
+    SDL_MemoryBarrierRelease();
+    SDL_SetAtomicInt(&queue->tail, tail + 1);
+
+    return 1;
+}
+
+uint8_t input_queue_pop(InputQueue *queue, InputEvent *event) {
+    int head = SDL_GetAtomicInt(&queue->head);
+
+    if (head == SDL_GetAtomicInt(&queue->tail)) return 0; // empty
+
+    SDL_MemoryBarrierAcquire();
+    *event = queue->events[head & (INPUT_QUEUE_SIZE - 1)];
+
+    SDL_SetAtomicInt(&queue->head, head + 1);
+
+    return 1;
+}
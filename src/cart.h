@@ -5,6 +5,27 @@
 #include <SDL3/SDL.h>
 
 #include "gb.h"
+#include "audio.h"
+
+#define INPUT_QUEUE_SIZE 64 // has to be a power of 2
+
+typedef enum InputEventType {
+    INPUT_EVENT_JOYPAD,
+    INPUT_EVENT_SAVE
+} InputEventType;
+
+typedef struct InputEvent {
+    InputEventType type;
+    uint8_t data;
+} InputEvent;
+
+// lock-free single-producer/single-consumer queue,
+// the render thread pushes and the emulation thread pops
+typedef struct InputQueue {
+    InputEvent events[INPUT_QUEUE_SIZE];
+    SDL_AtomicInt head;
+    SDL_AtomicInt tail;
+} InputQueue;
 
 typedef struct Emulator {
     SDL_Window *window;
@@ -13,9 +34,42 @@ typedef struct Emulator {
     SDL_AudioStream *audio_stream;
     SDL_Event event;
     const bool *keys;
+
+    // shade index -> texture pixel value, see cart_set_palette()
+    Uint32 palette[4];
     
     uint8_t should_close;
 
+    SDL_Thread *emu_thread;
+    SDL_AtomicInt running;
+
+    // triple buffering: the emulation thread fills frames[back_frame],
+    // the render thread shows frames[front_frame] and the third buffer
+    // is swapped through middle_frame, so neither thread ever waits
+    uint8_t frames[3][GB_SCREEN_W * GB_SCREEN_H];
+    uint8_t back_frame;
+    uint8_t front_frame;
+    SDL_AtomicInt middle_frame;
+
+    InputQueue input_queue;
+    uint8_t joypad_state;
+
+    AudioRing audio_ring;
+
+    // the batch pushed into the ring after every frame, silent
+    // until the APU mixes channels, see cart_queue_audio()
+    int16_t audio_samples[AUDIO_MAX_FRAME_SAMPLES * 2];
+    uint64_t audio_sample_counter;
+
+    // optional, only used when built with CART_STATS
+    struct Stats *stats;
+
+    // only set while recording, see CART_RECORD
+    struct Movie *movie;
+
+    // link cable output, see CART_SERIAL
+    SerialCapture *serial_capture;
+
     GB *gb;
 } Emulator;
 
@@ -29,4 +83,10 @@ void cart_handle_events(Emulator *emu);
 
 void cart_render(Emulator *emu);
 
+void cart_set_palette(Emulator *emu, const uint8_t colors[4][3]);
+
+uint8_t input_queue_push(InputQueue *queue, InputEvent event);
+
+uint8_t input_queue_pop(InputQueue *queue, InputEvent *event);
+
 #endif
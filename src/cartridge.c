@@ -122,7 +122,7 @@ static uint8_t cartridge_read_mbc1(Cartridge *cart, uint16_t addr) {
         }
         case 0xA000: // switchable RAM bank
         case 0xB000: {
-            if (!cart->ram_enable) break;
+            if (!cart->ram_enable || cart->ram_size == 0) break;
 
             uint32_t loc = (addr - CART_RAM_BASE_ADDR);
             if (cart->banking_mode == 1) loc |= ((uint32_t)cart->secondary_bank << 13);
@@ -162,7 +162,7 @@ static uint8_t cartridge_read_mbc2(Cartridge *cart, uint16_t addr) {
 
             uint32_t loc = (addr - CART_RAM_BASE_ADDR) % 0x0200;
 
-            if (loc < cart->rom_size) val = cart->ram[loc];
+            if (loc < cart->ram_size) val = cart->ram[loc];
             break;
         }       
     }
@@ -170,6 +170,13 @@ static uint8_t cartridge_read_mbc2(Cartridge *cart, uint16_t addr) {
     return val;
 }
 
+// banks past the end of SRAM mirror the ones below, the size is a power of two
+static uint32_t mbc3_ram_loc(Cartridge *cart, uint16_t addr) {
+    uint32_t loc = (addr - CART_RAM_BASE_ADDR) | ((uint32_t)cart->secondary_bank << 13);
+
+    return loc & (cart->ram_size - 1);
+}
+
 static uint8_t cartridge_read_mbc3(Cartridge *cart, uint16_t addr) {
     uint8_t val = 0xFF;
 
@@ -193,8 +200,8 @@ static uint8_t cartridge_read_mbc3(Cartridge *cart, uint16_t addr) {
             
         case 0xA000: // switchable RAM bank or RTC register
         case 0xB000:
-            if (cart->secondary_bank <= 0x07 && cart->ram_enable)
-                val = cart->ram[(addr - CART_RAM_BASE_ADDR) | (cart->secondary_bank << 13)];
+            if (cart->secondary_bank <= 0x07 && cart->ram_enable && cart->ram_size > 0)
+                val = cart->ram[mbc3_ram_loc(cart, addr)];
             // TODO -> RTC registers
             break;
     }
@@ -203,8 +210,10 @@ static uint8_t cartridge_read_mbc3(Cartridge *cart, uint16_t addr) {
 }
 
 static void cartridge_write_no_mbc(Cartridge *cart, uint16_t addr, uint8_t val) {
-    if (0xA000 <= addr && addr <= 0xBFFF && (addr - 0xA000) <= cart->ram_size)
+    if (0xA000 <= addr && addr <= 0xBFFF && (addr - 0xA000) < cart->ram_size) {
+        SHARED_BLOCK_WRITE(cart->ram_block, cart->ram);
         cart->ram[addr - 0xA000] = val;
+    }
 }
 
 static void cartridge_write_mbc1(Cartridge *cart, uint16_t addr, uint8_t val) {
@@ -231,11 +240,12 @@ static void cartridge_write_mbc1(Cartridge *cart, uint16_t addr, uint8_t val) {
 
         case 0xA000: // switchable RAM bank
         case 0xB000: {
-             if (!cart->ram_enable) break;
+            if (!cart->ram_enable || cart->ram_size == 0) break;
 
             uint32_t loc = addr - CART_RAM_BASE_ADDR;
             if (cart->banking_mode == 1) loc |= ((uint32_t)cart->secondary_bank << 13);
 
+            SHARED_BLOCK_WRITE(cart->ram_block, cart->ram);
             cart->ram[loc & (cart->ram_size - 1)] = val;
             break;
         } 
@@ -255,6 +265,7 @@ static void cartridge_write_mbc2(Cartridge *cart, uint16_t addr, uint8_t val) {
         case 0xA000: // built-in RAM bank and its 'echoes'
         case 0xB000:
             if (!cart->ram_enable) break;
+            SHARED_BLOCK_WRITE(cart->ram_block, cart->ram);
             cart->ram[(addr - CART_RAM_BASE_ADDR) % 0x0200] = val;
             break;
     }
@@ -283,8 +294,10 @@ static void cartridge_write_mbc3(Cartridge *cart, uint16_t addr, uint8_t val) {
 
         case 0xA000: // switchable RAM bank or RTC
         case 0xB000:
-            if (cart->secondary_bank <= 0x07 && cart->ram_enable)
-                cart->ram[(addr - CART_RAM_BASE_ADDR) | (cart->secondary_bank << 13)] = val;
+            if (cart->secondary_bank <= 0x07 && cart->ram_enable && cart->ram_size > 0) {
+                SHARED_BLOCK_WRITE(cart->ram_block, cart->ram);
+                cart->ram[mbc3_ram_loc(cart, addr)] = val;
+            }
             // TODO -> RTC registers
             break;
     }
@@ -293,42 +306,78 @@ static void cartridge_write_mbc3(Cartridge *cart, uint16_t addr, uint8_t val) {
 
 
 Cartridge *create_cartridge(const char *rom_file) {
-    Cartridge *new_cart = (Cartridge*)malloc(sizeof(Cartridge));
-
     uint8_t *rom_buf = read_file_to_array(rom_file, 1);
 
-    if (rom_buf == NULL) {
-        destroy_cartridge(new_cart);
-        return NULL;
-    }
+    if (rom_buf == NULL) return NULL;
+
+    return create_cartridge_from_rom(rom_buf);
+}
+
+// the cartridge takes ownership of rom_buf,
+// which has to be allocated with malloc()
+Cartridge *create_cartridge_from_rom(uint8_t *rom_buf) {
+    Cartridge *new_cart = (Cartridge*)malloc(sizeof(Cartridge));
 
     new_cart->type = get_cart_type(rom_buf[CART_TYPE_ADDR]);
-    new_cart->rom = rom_buf;
     new_cart->rom_size = get_cart_rom_size(rom_buf[CART_ROM_SIZE_ADDR]);
     new_cart->ram_size = (new_cart->type != CART_TYPE_MBC2)
         ? get_cart_ram_size(rom_buf[CART_RAM_SIZE_ADDR])
         : 0x200;
 
-    new_cart->ram = (uint8_t*)malloc(new_cart->ram_size);
+    new_cart->rom_block = create_shared_block_from(rom_buf, new_cart->rom_size);
+    new_cart->ram_block = create_shared_block(new_cart->ram_size);
+    new_cart->rom = new_cart->rom_block->data;
+    new_cart->ram = new_cart->ram_block->data;
 
     new_cart->ram_enable = 0;
     new_cart->primary_bank = 0x00;
     new_cart->secondary_bank = 0x00;
     new_cart->banking_mode = 0;
 
-    memset(new_cart->ram, 0, new_cart->ram_size);
-
     return new_cart;
 }
 
 void destroy_cartridge(Cartridge *cart) {
     if (cart == NULL)  return;
 
-    free(cart->ram);
-    free(cart->rom);
+    cartridge_release(cart);
     free(cart);
 }
 
+// drops the ROM and SRAM without freeing 'cart', for cartridges
+// that weren't allocated with malloc(), see gb_clone()
+void cartridge_release(Cartridge *cart) {
+    shared_block_release(cart->ram_block);
+    shared_block_release(cart->rom_block);
+}
+
+// a cartridge in the same state as 'cart', sharing its ROM and SRAM
+Cartridge *create_cartridge_fork(Cartridge *cart) {
+    Cartridge *new_cart = (Cartridge*)malloc(sizeof(Cartridge));
+
+    new_cart->rom_block = NULL;
+    new_cart->ram_block = NULL;
+
+    cartridge_share(new_cart, cart);
+
+    return new_cart;
+}
+
+// turns 'cart' into a fork of 'src', dropping whatever it held before
+void cartridge_share(Cartridge *cart, Cartridge *src) {
+    SharedBlock *rom_block = cart->rom_block;
+    SharedBlock *ram_block = cart->ram_block;
+
+    *cart = *src;
+
+    cart->rom_block = shared_block_ref(src->rom_block);
+    cart->ram_block = shared_block_ref(src->ram_block);
+
+    // released last in case both already shared them
+    shared_block_release(rom_block);
+    shared_block_release(ram_block);
+}
+
 uint8_t cartridge_read(Cartridge *cart, uint16_t addr) {
     uint8_t val = 0xFF;
 
@@ -348,6 +397,8 @@ uint8_t cartridge_read(Cartridge *cart, uint16_t addr) {
 }
 
 
+// a fork gets its own SRAM once one of the handlers writes to it,
+// writes to disabled RAM don't count
 void cartridge_write(Cartridge *cart, uint16_t addr, uint8_t val) {
     switch (cart->type) {
         case CART_TYPE_NO_MBC:
@@ -361,3 +412,23 @@ void cartridge_write(Cartridge *cart, uint16_t addr, uint8_t val) {
         case CART_TYPE_UNKNOWN: return;
     }
 }
+
+// the ROM bank currently mapped to 0x4000-0x7FFF
+uint16_t cartridge_rom_bank(Cartridge *cart) {
+    uint32_t bank = 1;
+
+    switch (cart->type) {
+        case CART_TYPE_MBC1:
+            bank = MAX(cart->primary_bank, 0x01) | ((uint32_t)cart->secondary_bank << 5);
+            break;
+        case CART_TYPE_MBC2:
+            bank = MAX(cart->primary_bank, 0x01); break;
+        case CART_TYPE_MBC3:
+            bank = cart->primary_bank; break;
+        case CART_TYPE_NO_MBC:
+        case CART_TYPE_UNKNOWN:
+            break;
+    }
+
+    return (uint16_t)(bank & ((cart->rom_size >> 14) - 1));
+}
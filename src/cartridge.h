@@ -3,6 +3,8 @@
 
 #include <stdint.h>
 
+#include "shared_block.h"
+
 #define KIB_8   0x00002000
 #define KIB_32  0x00008000
 #define KIB_64  0x00010000
@@ -41,8 +43,11 @@ typedef enum CartridgeType {
 typedef struct Cartridge {
     CartridgeType type;
 
+    // point into rom_block and ram_block, which forks share
     uint8_t *rom;
     uint8_t *ram;
+    SharedBlock *rom_block;
+    SharedBlock *ram_block;
 
     uint32_t rom_size;
     uint32_t ram_size;
@@ -55,10 +60,20 @@ typedef struct Cartridge {
 
 Cartridge *create_cartridge(const char *rom_file);
 
+Cartridge *create_cartridge_from_rom(uint8_t *rom_buf);
+
 void destroy_cartridge(Cartridge *cart);
 
+void cartridge_release(Cartridge *cart);
+
+Cartridge *create_cartridge_fork(Cartridge *cart);
+
+void cartridge_share(Cartridge *cart, Cartridge *src);
+
 uint8_t cartridge_read(Cartridge *cart, uint16_t addr);
 
 void cartridge_write(Cartridge *cart, uint16_t addr, uint8_t val);
 
+uint16_t cartridge_rom_bank(Cartridge *cart);
+
 #endif
@@ -3,6 +3,9 @@
 #include "gb.h"
 #include "util.h"
 #include "opcodes.h"
+#include "profiler.h"
+#include "trace.h"
+#include "stats.h"
 #include <stdio.h>
 
 uint8_t print_debug = 0;
@@ -61,26 +64,7 @@ static inline uint8_t evaluate_condition(CPU *cpu, CPUCondition cond) {
 }
 
 static inline uint8_t pc_read_byte(CPU *cpu) {
-    uint8_t byte = mmu_read(&cpu->gb->mmu, cpu->pc++);
-
-    if (0)
-        printf(
-                "%x fetch byte: %x a: %x b: %x c: %x d: %x e: %x h: %x l: %x sp: %x flags: %x\n",
-                cpu->pc-1,
-                byte,
-                cpu->a,
-                cpu->b, 
-                cpu->c,
-                cpu->d,
-                cpu->e,
-                cpu->h,
-                cpu->l,
-                cpu->sp,
-                cpu->f
-        );
-
-
-    return byte; 
+    return mmu_read(&cpu->gb->mmu, cpu->pc++);
 }
 
 
@@ -114,12 +98,18 @@ uint8_t cpu_step(CPU *cpu) {
     if (cycles > 0) return cycles;
     if (cpu->halted == 1) return 1;
 
+    uint16_t opcode_pc = cpu->pc;
     uint8_t opcode = pc_read_byte(cpu);
 
+    TRACE_INSTRUCTION(cpu->gb, opcode_pc, opcode);
+
     cycles = (opcode != 0xCB)
         ? cpu_execute(cpu, opcode)
         : cpu_execute_prefixed(cpu, pc_read_byte(cpu));
 
+    PROFILER_INSTRUCTION(cpu->gb, opcode_pc, opcode, cycles);
+    STATS_COUNT(cpu->gb->stats, STATS_COUNTER_INSTRUCTIONS);
+
     if (cpu->ime_set_pending > 0) {
         if (cpu->ime_set_pending == 1) cpu->ime = 1;
         cpu->ime_set_pending--;
@@ -395,6 +385,9 @@ uint8_t cpu_handle_interrupts(CPU *cpu) {
             // call interrupt handler
             push_stack(cpu, cpu->pc);
             cpu->pc = 0x0040 + (i << 3); 
+
+            PROFILER_INTERRUPT(cpu->gb, cpu->pc, 5);
+            STATS_COUNT(cpu->gb->stats, STATS_COUNTER_INTERRUPTS);
         }
     }
 
@@ -0,0 +1,108 @@
+#include "env.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+// shade index -> gray
+static const uint8_t GRAYS[4] = { 0xFF, 0xAA, 0x55, 0x00 };
+
+// takes ownership of a GB fresh from create_gb() and runs or skips the boot ROM
+Env *create_env(GB *gb, uint8_t frame_skip, uint8_t skip_boot) {
+    if (gb == NULL) return NULL;
+
+    if (skip_boot) {
+        gb_skip_boot(gb);
+    } else if (gb_run_boot(gb) == 0) {
+        fprintf(stderr, "create_env(): The boot ROM didn't hand over to the cartridge.\n");
+        destroy_gb(gb);
+        return NULL;
+    }
+
+    Env *new_env = (Env*)malloc(sizeof(Env));
+
+    new_env->gb = gb;
+    new_env->reset_state = (uint8_t*)malloc(gb_state_size(gb));
+    new_env->frame_skip = frame_skip;
+    new_env->frames = 0;
+
+    memset(new_env->observation, 0xFF, sizeof(new_env->observation));
+
+    gb_save_state(gb, new_env->reset_state);
+
+    return new_env;
+}
+
+void destroy_env(Env *env) {
+    if (env == NULL) return;
+
+    destroy_gb(env->gb);
+    free(env->reset_state);
+    free(env);
+}
+
+// back to the state right after the boot ROM
+void env_reset(Env *env) {
+    gb_load_state(env->gb, env->reset_state);
+    env->frames = 0;
+}
+
+// holds 'action' (bit n is the JoypadButton with value n) for 'frames'
+void env_step(Env *env, uint8_t action, uint32_t frames) {
+    GB *gb = env->gb;
+
+    joypad_set(&gb->joypad, action);
+
+    for (uint32_t f = 0; f < frames; f++) {
+        // a frame is drawn while it runs, so this covers the current one
+        ppu_set_render_enable(&gb->ppu, env->frame_skip == 0 || f + 1 == frames);
+
+        gb_run_frame(gb);
+    }
+
+    env->frames += frames;
+}
+
+// GB_SCREEN_W * GB_SCREEN_H shade indices, 0 is white
+const uint8_t *env_framebuffer(Env *env) {
+    return env->gb->framebuffer;
+}
+
+// WRAM_SIZE bytes, 0xC000-0xDFFF
+const uint8_t *env_wram(Env *env) {
+    return env->gb->wram;
+}
+
+// the screen in grayscale, every 'scale' x 'scale' pixels averaged
+// into one, so it's (GB_SCREEN_W / scale) x (GB_SCREEN_H / scale)
+const uint8_t *env_observation(Env *env, uint8_t scale) {
+    const uint8_t *framebuffer = env->gb->framebuffer;
+
+    if (scale == 0 || GB_SCREEN_W % scale != 0 || GB_SCREEN_H % scale != 0) {
+        fprintf(stderr, "env_observation(): Scale has to divide the screen size.\n");
+        return NULL;
+    }
+
+    if (scale == 1) {
+        for (uint32_t i = 0; i < GB_SCREEN_W * GB_SCREEN_H; i++) env->observation[i] = GRAYS[framebuffer[i] & 0x03];
+
+        return env->observation;
+    }
+
+    uint32_t w = GB_SCREEN_W / scale;
+    uint32_t h = GB_SCREEN_H / scale;
+
+    for (uint32_t y = 0; y < h; y++) {
+        for (uint32_t x = 0; x < w; x++) {
+            uint32_t sum = 0;
+
+            for (uint32_t dy = 0; dy < scale; dy++)
+                for (uint32_t dx = 0; dx < scale; dx++)
+                    sum += GRAYS[framebuffer[(y * scale + dy) * GB_SCREEN_W + x * scale + dx] & 0x03];
+
+            env->observation[y * w + x] = (uint8_t)(sum / (scale * scale));
+        }
+    }
+
+    return env->observation;
+}
@@ -0,0 +1,53 @@
+#ifndef ENV_H
+#define ENV_H
+
+#include <stdint.h>
+
+#include "gb.h"
+
+// Environment API for driving a GB from training code.
+//
+// An Env boots its GB once, or with 'skip_boot' sets it up as the boot
+// ROM would have (see gb_skip_boot()), and keeps the state right after
+// the boot ROM, which env_reset() restores. env_step() holds a joypad bitmask
+// for a number of frames. Observations point into the live GB where
+// possible: env_framebuffer() and env_wram() stay valid for the
+// lifetime of the Env (as long as its GB isn't forked, which moves
+// them), env_observation() fills a buffer owned by the Env.
+//
+// A step costs about as much as the frames it runs, the Env adds
+// nothing per frame. With 4 frames per step that's roughly 800 steps
+// per second on one core (env_step/4_frames in cart_bench), so higher
+// rates take many Envs running on separate threads.
+
+typedef struct Env {
+    GB *gb;
+
+    // state after the boot ROM, see env_reset()
+    uint8_t *reset_state;
+
+    // when set only the last frame of every step is drawn
+    uint8_t frame_skip;
+
+    // frames run since the last reset
+    uint64_t frames;
+
+    // grayscale, 255 is white
+    uint8_t observation[GB_SCREEN_W * GB_SCREEN_H];
+} Env;
+
+Env *create_env(GB *gb, uint8_t frame_skip, uint8_t skip_boot);
+
+void destroy_env(Env *env);
+
+void env_reset(Env *env);
+
+void env_step(Env *env, uint8_t action, uint32_t frames);
+
+const uint8_t *env_framebuffer(Env *env);
+
+const uint8_t *env_wram(Env *env);
+
+const uint8_t *env_observation(Env *env, uint8_t scale);
+
+#endif
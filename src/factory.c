@@ -0,0 +1,62 @@
+#include "factory.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+
+Factory *create_factory(const char *rom_file, uint8_t skip_boot) {
+    GB *gb = create_gb(rom_file);
+
+    if (gb == NULL) return NULL;
+
+    return create_factory_from_gb(gb, skip_boot);
+}
+
+// takes ownership of a GB fresh from create_gb() and boots it, or
+// skips the boot ROM
+Factory *create_factory_from_gb(GB *gb, uint8_t skip_boot) {
+    if (gb == NULL) return NULL;
+
+    if (skip_boot) {
+        gb_skip_boot(gb);
+    } else if (gb_run_boot(gb) == 0) {
+        fprintf(stderr, "create_factory_from_gb(): The boot ROM didn't hand over to the cartridge.\n");
+        destroy_gb(gb);
+        return NULL;
+    }
+
+    Factory *new_factory = (Factory*)malloc(sizeof(Factory));
+
+    new_factory->template_gb = gb;
+    new_factory->spawned = 0;
+    new_factory->pool = create_arena_pool(gb_arena_size(gb->cartridge->ram_size));
+
+    return new_factory;
+}
+
+// spawned and cloned GBs stay valid, they hold their own references
+// to the memory and arenas
+void destroy_factory(Factory *factory) {
+    if (factory == NULL) return;
+
+    destroy_gb(factory->template_gb);
+    destroy_arena_pool(factory->pool);
+    free(factory);
+}
+
+// a new GB in the post-boot state, free it with destroy_gb()
+GB *factory_spawn(Factory *factory) {
+    factory->spawned++;
+
+    return gb_fork(factory->template_gb);
+}
+
+void factory_spawn_many(Factory *factory, GB **gbs, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) gbs[i] = factory_spawn(factory);
+}
+
+// a new GB in the post-boot state in one arena, free it with destroy_gb()
+GB *factory_clone(Factory *factory) {
+    factory->spawned++;
+
+    return gb_clone(factory->template_gb, factory->pool);
+}
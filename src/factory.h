@@ -0,0 +1,38 @@
+#ifndef FACTORY_H
+#define FACTORY_H
+
+#include <stdint.h>
+
+#include "gb.h"
+
+// Mass creation of GBs that start right after the boot ROM.
+//
+// A factory loads the ROM and runs the boot ROM once (or skips it, see
+// gb_skip_boot()), then keeps that GB as a template. Spawning copies the template's GB struct and shares
+// its ROM, memory and framebuffer copy-on-write (see gb_fork()), so a
+// new instance costs a few KiB and no file access or emulation.
+// Cloning instead gives every instance its own copy of the memory in
+// one arena from the factory's pool (see gb_clone()), which costs a few
+// microseconds more but keeps each instance in one contiguous block.
+
+typedef struct Factory {
+    GB *template_gb;
+    uint64_t spawned;
+
+    // sized for the template, see factory_clone()
+    ArenaPool *pool;
+} Factory;
+
+Factory *create_factory(const char *rom_file, uint8_t skip_boot);
+
+Factory *create_factory_from_gb(GB *gb, uint8_t skip_boot);
+
+void destroy_factory(Factory *factory);
+
+GB *factory_spawn(Factory *factory);
+
+void factory_spawn_many(Factory *factory, GB **gbs, uint32_t count);
+
+GB *factory_clone(Factory *factory);
+
+#endif
@@ -1,12 +1,24 @@
 #include "gb.h"
 
 #include <stdlib.h>
+#include <stdio.h>
 #include <string.h>
 
-GB *create_gb(const char *rom_file) {
-    GB *new_gb = (GB*)malloc(sizeof(GB));
+#include "util.h"
+#include "stats.h"
+#include "state_hash.h"
+
+static GB *create_gb_with_cartridge(Cartridge *cartridge) {
+    GB *new_gb = (GB*)calloc(1, sizeof(GB));
 
-    new_gb->cartridge = create_cartridge(rom_file);
+    new_gb->cartridge = cartridge;
+
+    new_gb->framebuffer_block = create_shared_block(GB_SCREEN_W * GB_SCREEN_H);
+    new_gb->vram_block = create_shared_block(VRAM_SIZE);
+    new_gb->wram_block = create_shared_block(WRAM_SIZE);
+    new_gb->framebuffer = new_gb->framebuffer_block->data;
+    new_gb->vram = new_gb->vram_block->data;
+    new_gb->wram = new_gb->wram_block->data;
 
     if (new_gb->cartridge == NULL) {
         destroy_gb(new_gb);
@@ -19,34 +31,468 @@ GB *create_gb(const char *rom_file) {
     apu_init(&new_gb->apu, new_gb);
     joypad_init(&new_gb->joypad, new_gb);
     timer_init(&new_gb->timer, new_gb);
+    serial_init(&new_gb->serial, new_gb);
 
     memset(new_gb->framebuffer, 0x03, GB_SCREEN_W * GB_SCREEN_H);
     new_gb->frame_ready = 0;
 
-    memset(new_gb->vram, 0x00, VRAM_SIZE);
-    memset(new_gb->wram, 0x00, WRAM_SIZE);
     memset(new_gb->oam, 0x00, OAM_SIZE);
     memset(new_gb->io, 0x00, IO_SIZE);
     memset(new_gb->hram, 0x00, HRAM_SIZE);
     new_gb->ie = 0x00;
 
+    new_gb->cycles = 0;
+    new_gb->arena = NULL;
+
+    new_gb->profiler = NULL;
+    new_gb->trace = NULL;
+    new_gb->stats = NULL;
+    new_gb->state_hash = NULL;
+
     return new_gb;
 }
 
+GB *create_gb(const char *rom_file) {
+    return create_gb_with_cartridge(create_cartridge(rom_file));
+}
+
+// rom_buf is owned by the GB afterwards, see create_cartridge_from_rom()
+GB *create_gb_from_rom(uint8_t *rom_buf) {
+    return create_gb_with_cartridge(create_cartridge_from_rom(rom_buf));
+}
+
 void destroy_gb(GB *gb) {
     if (gb == NULL) return;
 
+    shared_block_release(gb->framebuffer_block);
+    shared_block_release(gb->vram_block);
+    shared_block_release(gb->wram_block);
+
+    if (gb->arena != NULL) {
+        // the GB and cartridge structs go away with the arena
+        cartridge_release(gb->cartridge);
+        arena_release(gb->arena);
+        return;
+    }
+
     destroy_cartridge(gb->cartridge);
     free(gb);
 }
 
-void gb_step(GB *gb) {
+static void gb_relink(GB *gb) {
+    gb->cpu.gb = gb;
+    gb->mmu.gb = gb;
+    gb->ppu.gb = gb;
+    gb->apu.gb = gb;
+    gb->joypad.gb = gb;
+    gb->timer.gb = gb;
+    gb->serial.gb = gb;
+}
+
+// a new GB in the same state as 'gb', which shares its memory until either
+// of them writes to it, see gb_fork_into()
+GB *gb_fork(GB *gb) {
+    GB *new_gb = (GB*)malloc(sizeof(GB));
+
+    new_gb->cartridge = create_cartridge_fork(gb->cartridge);
+    new_gb->framebuffer_block = NULL;
+    new_gb->vram_block = NULL;
+    new_gb->wram_block = NULL;
+    new_gb->arena = NULL;
+
+    gb_fork_into(gb, new_gb);
+
+    return new_gb;
+}
+
+// turns an existing GB into a fork of 'gb' without allocating, so that
+// forks can be pooled. VRAM, WRAM, SRAM and the framebuffer are copied
+// when first written (8 KiB each for VRAM and WRAM, 22.5 KiB for the
+// framebuffer and up to 128 KiB for SRAM), the ROM is never copied. The
+// fork isn't connected to the link port and has none of the optional
+// profiler, trace, stats or state hash attached.
+void gb_fork_into(GB *gb, GB *fork) {
+    Cartridge *cart = fork->cartridge;
+    SharedBlock *framebuffer_block = fork->framebuffer_block;
+    SharedBlock *vram_block = fork->vram_block;
+    SharedBlock *wram_block = fork->wram_block;
+    Arena *arena = fork->arena;
+
+    *fork = *gb;
+
+    fork->arena = arena;
+
+    fork->cartridge = cart;
+    cartridge_share(fork->cartridge, gb->cartridge);
+
+    fork->framebuffer_block = shared_block_ref(gb->framebuffer_block);
+    fork->vram_block = shared_block_ref(gb->vram_block);
+    fork->wram_block = shared_block_ref(gb->wram_block);
+
+    shared_block_release(framebuffer_block);
+    shared_block_release(vram_block);
+    shared_block_release(wram_block);
+
+    gb_relink(fork);
+
+    fork->serial.exchange = NULL;
+    fork->serial.userdata = NULL;
+
+    fork->profiler = NULL;
+    fork->trace = NULL;
+    fork->stats = NULL;
+    fork->state_hash = NULL;
+}
+
+// bytes an arena needs to hold a GB with 'ram_size' bytes of SRAM
+size_t gb_arena_size(uint32_t ram_size) {
+    return ARENA_ALIGN_UP(sizeof(GB))
+        + ARENA_ALIGN_UP(sizeof(Cartridge))
+        + ARENA_ALIGN_UP(sizeof(SharedBlock)) * 4
+        + ARENA_ALIGN_UP(GB_SCREEN_W * GB_SCREEN_H)
+        + ARENA_ALIGN_UP(VRAM_SIZE)
+        + ARENA_ALIGN_UP(WRAM_SIZE)
+        + ARENA_ALIGN_UP(ram_size);
+}
+
+// a GB in the same state as 'gb' that lives in a single arena from
+// 'pool', along with its cartridge, memory and framebuffer. Unlike a
+// fork it gets its own copies of VRAM, WRAM, SRAM and the framebuffer
+// right away, only the ROM is shared. destroy_gb() hands the arena
+// back to the pool.
+GB *gb_clone(GB *gb, ArenaPool *pool) {
+    if (gb_arena_size(gb->cartridge->ram_size) > pool->arena_size) {
+        fprintf(stderr, "gb_clone(): The arenas of the pool are too small.\n");
+        return NULL;
+    }
+
+    Arena *arena = arena_acquire(pool);
+
+    if (arena == NULL) return NULL;
+
+    // zeroed, so there are no blocks to drop yet
+    GB *new_gb = (GB*)arena_alloc(arena, sizeof(GB));
+
+    new_gb->cartridge = (Cartridge*)arena_alloc(arena, sizeof(Cartridge));
+    new_gb->arena = arena;
+
+    gb_fork_into(gb, new_gb);
+
+    new_gb->framebuffer = shared_block_own_in(&new_gb->framebuffer_block, arena);
+    new_gb->vram = shared_block_own_in(&new_gb->vram_block, arena);
+    new_gb->wram = shared_block_own_in(&new_gb->wram_block, arena);
+    new_gb->cartridge->ram = shared_block_own_in(&new_gb->cartridge->ram_block, arena);
+
+    return new_gb;
+}
+
+// create_gb() with everything but the ROM in one arena, see gb_clone()
+GB *create_gb_in_pool(ArenaPool *pool, const char *rom_file) {
+    GB *gb = create_gb(rom_file);
+
+    if (gb == NULL) return NULL;
+
+    GB *new_gb = gb_clone(gb, pool);
+
+    destroy_gb(gb);
+
+    return new_gb;
+}
+
+uint8_t gb_step(GB *gb) {
+    STATS_BEGIN(gb->stats);
+
     uint8_t cpu_cycles = cpu_step(&gb->cpu);
+    STATS_LAP(gb->stats, STATS_TIMER_CPU);
+
+    mmu_step(&gb->mmu, cpu_cycles);
+    STATS_LAP(gb->stats, STATS_TIMER_DMA);
+
     ppu_step(&gb->ppu, cpu_cycles);
+    STATS_LAP(gb->stats, STATS_TIMER_PPU);
+
     apu_step(&gb->apu, cpu_cycles);
+    STATS_LAP(gb->stats, STATS_TIMER_APU);
+
     timer_step(&gb->timer, cpu_cycles);
+    STATS_LAP(gb->stats, STATS_TIMER_TIMER);
+
+    serial_step(&gb->serial, cpu_cycles);
+
+    gb->cycles += cpu_cycles;
+
+    return cpu_cycles;
+}
+
+// A halted CPU only waits for an interrupt, one cycle per gb_step().
+// The steps before the next one that could request an interrupt (or
+// do anything else but count) are run at once, with the same result.
+// Returns the cycles skipped, at most 'max_cycles'.
+static uint32_t gb_skip_halt(GB *gb, uint32_t max_cycles) {
+    if (gb->cpu.halted == 0 || gb->mmu.dma_cycles > 0) return 0;
+    if (gb->cpu.ime != 0 && (gb->ie & gb->io[IF_ADDR_RELATIVE]) != 0) return 0;
+
+    // every step runs the PPU for one dot more than the cycle takes, see ppu_step()
+    uint32_t cycles = MIN(ppu_quiet_dots(&gb->ppu) / (DOTS_PER_CYCLE_DMG + 1), max_cycles);
+
+    cycles = MIN(cycles, timer_quiet_cycles(&gb->timer));
+
+    if (gb->serial.transfer_cycles > 0) cycles = MIN(cycles, gb->serial.transfer_cycles - 1u);
+
+    if (cycles == 0) return 0;
+
+    ppu_skip_dots(&gb->ppu, cycles * (DOTS_PER_CYCLE_DMG + 1));
+
+    for (uint32_t left = cycles; left > 0;) {
+        uint8_t chunk = (uint8_t)MIN(left, 0xFF);
+
+        apu_step(&gb->apu, chunk);
+        timer_step(&gb->timer, chunk);
+        serial_step(&gb->serial, chunk);
+
+        left -= chunk;
+    }
+
+    gb->cycles += cycles;
+
+    return cycles;
+}
+
+void gb_run_frame(GB *gb) {
+    uint32_t cycles = 0;
+
+    // with the LCD off a frame is never finished, so
+    // the run is also limited to the length of one frame
+    while (gb->frame_ready == 0 && cycles < GB_CYCLES_PER_FRAME) {
+        uint32_t skipped = gb_skip_halt(gb, GB_CYCLES_PER_FRAME - cycles);
+
+        cycles += (skipped > 0) ? skipped : gb_step(gb);
+    }
+
+    gb->frame_ready = 0;
+
+    if (gb->state_hash != NULL && gb->state_hash->hash_frames == 1)
+        gb->state_hash->frame_hash = gb_state_hash(gb);
+}
+
+// runs until the boot ROM unmaps itself and the cartridge takes over,
+// returns 0 if it never does, e.g. because the header logo is wrong
+uint8_t gb_run_boot(GB *gb) {
+    for (uint32_t f = 0; f < GB_BOOT_MAX_FRAMES && gb->mmu.bootrom_mapped; f++) gb_run_frame(gb);
+
+    return gb->mmu.bootrom_mapped == 0;
+}
+
+// the boot ROM draws the logo from the cartridge header with
+// every pixel doubled, followed by the (R) tile from its own data
+static void gb_skip_boot_logo(GB *gb) {
+    SHARED_BLOCK_WRITE(gb->vram_block, gb->vram);
+
+    uint8_t *tiles = gb->vram + 0x0010;
+
+    for (uint8_t i = 0; i < GB_BOOT_LOGO_SIZE * 2; i++) {
+        uint8_t nibble = gb->cartridge->rom[GB_BOOT_LOGO_ADDR + i / 2] >> ((i & 1) ? 0 : 4);
+        uint8_t row = 0;
+
+        for (uint8_t b = 0; b < 4; b++)
+            if (nibble & (0x01 << b)) row |= 0x03 << (b * 2);
+
+        tiles[0] = row;
+        tiles[2] = row;
+        tiles += 4;
+    }
+
+    for (uint8_t i = 0; i < 8; i++)
+        tiles[i * 2] = mmu_read(&gb->mmu, GB_BOOT_REGISTERED_ADDR + i);
+
+    uint8_t *map = gb->vram + 0x1904;
+
+    for (uint8_t t = 0; t < 12; t++) {
+        map[t] = t + 1;
+        map[t + 0x20] = t + 13;
+    }
+
+    map[12] = 25;
+}
+
+// jumps to 0x0100 with the state the DMG boot ROM leaves behind
+void gb_skip_boot(GB *gb) {
+    if (gb->mmu.bootrom_mapped == 0) return;
+
+    gb_skip_boot_logo(gb);
+
+    gb->mmu.bootrom_mapped = 0;
+
+    // F depends on the header checksum the boot ROM verifies
+    gb->cpu.a = 0x01;
+    gb->cpu.f = (gb->cartridge->rom[GB_HEADER_CHECKSUM_ADDR] == 0) ? 0x80 : 0xB0;
+    gb->cpu.b = 0x00;
+    gb->cpu.c = 0x13;
+    gb->cpu.d = 0x00;
+    gb->cpu.e = 0xD8;
+    gb->cpu.h = 0x01;
+    gb->cpu.l = 0x4D;
+    gb->cpu.sp = 0xFFFE;
+    gb->cpu.pc = 0x0100;
+
+    uint8_t *io = gb->io;
+
+    io[JOYP_ADDR - IO_BASE_ADDR] = 0xCF;
+    io[SC_ADDR_RELATIVE] = 0x7E;
+    io[DIV_ADDR_RELATIVE] = 0xAB;
+    io[TAC_ADDR_RELATIVE] = 0xF8;
+    io[IF_ADDR_RELATIVE] = 0x01; // reads as 0xE1
+
+    // the boot chime
+    io[NR11_ADDR_REL] = 0x80;
+    io[NR12_ADDR_REL] = 0xF3;
+    io[NR13_ADDR_REL] = 0xC1;
+    io[NR14_ADDR_REL] = 0x87;
+    io[NR50_ADDR_REL] = 0x77;
+    io[NR51_ADDR_REL] = 0xF3;
+    io[NR52_ADDR_REL] = 0x80;
+
+    // the boot ROM hands over in the middle of drawing the first line
+    gb->ppu.mode = PPU_MODE_PIXEL_DRAW;
+    gb->ppu.current_dot = GB_BOOT_END_DOT;
+    gb->timer.divider_counter = GB_BOOT_END_DIVIDER;
+
+    io[LCDC_ADDR_RELATIVE] = 0x91;
+    io[STAT_ADDR_RELATIVE] = 0x04 | PPU_MODE_PIXEL_DRAW; // LY == LYC
+    io[BGP_ADDR_RELATIVE] = 0xFC;
+    io[DMA_ADDR - IO_BASE_ADDR] = 0xFF;
+    io[BANK_ADDR - IO_BASE_ADDR] = 0x01;
+
+    if (gb->state_hash != NULL) state_hash_invalidate(gb->state_hash);
 }
 
 void gb_interrupt(GB *gb, Interrupt intr) {
-    mmu_write(&gb->mmu, IF_ADDR, mmu_read(&gb->mmu, IF_ADDR) | (0x01 << intr));
+    gb->io[IF_ADDR_RELATIVE] |= 0x01 << intr;
+}
+
+// the ROM bank the code at 'pc' is executed from
+uint16_t gb_code_bank(GB *gb, uint16_t pc) {
+    if (pc < 0x0100 && gb->mmu.bootrom_mapped == 1) return GB_BOOT_BANK;
+
+    if (pc >= CART_ROM_BASE_ADDR && pc < VRAM_BASE_ADDR) return cartridge_rom_bank(gb->cartridge);
+
+    return 0;
+}
+
+static uint8_t *state_put(uint8_t *dest, const void *src, size_t len) {
+    memcpy(dest, src, len);
+    return dest + len;
+}
+
+static const uint8_t *state_get(const uint8_t *src, void *dest, size_t len) {
+    memcpy(dest, src, len);
+    return src + len;
+}
+
+size_t gb_state_size(GB *gb) {
+    return sizeof(GBStateHeader)
+        + sizeof(CPU) + sizeof(MMU) + sizeof(PPU) + sizeof(PPULineLog) + sizeof(APU) + sizeof(Joypad) + sizeof(Timer) + sizeof(Serial)
+        + GB_SCREEN_W * GB_SCREEN_H + sizeof(gb->frame_ready)
+        + VRAM_SIZE + WRAM_SIZE + OAM_SIZE + IO_SIZE + HRAM_SIZE + sizeof(gb->ie)
+        + sizeof(gb->cycles)
+        + 4 + gb->cartridge->ram_size; // banking registers and SRAM
+}
+
+// 'state' has to hold gb_state_size() bytes
+void gb_save_state(GB *gb, uint8_t *state) {
+    GBStateHeader header = { GB_STATE_MAGIC, (uint32_t)gb_state_size(gb) };
+    Cartridge *cart = gb->cartridge;
+
+    // the components are stored whole, their gb pointers are relinked on load
+    state = state_put(state, &header, sizeof(header));
+    state = state_put(state, &gb->cpu, sizeof(CPU));
+    state = state_put(state, &gb->mmu, sizeof(MMU));
+    state = state_put(state, &gb->ppu, sizeof(PPU));
+    state = state_put(state, &gb->line_log, sizeof(PPULineLog));
+    state = state_put(state, &gb->apu, sizeof(APU));
+    state = state_put(state, &gb->joypad, sizeof(Joypad));
+    state = state_put(state, &gb->timer, sizeof(Timer));
+    state = state_put(state, &gb->serial, sizeof(Serial));
+
+    state = state_put(state, gb->framebuffer, GB_SCREEN_W * GB_SCREEN_H);
+    state = state_put(state, &gb->frame_ready, sizeof(gb->frame_ready));
+    state = state_put(state, gb->vram, VRAM_SIZE);
+    state = state_put(state, gb->wram, WRAM_SIZE);
+    state = state_put(state, gb->oam, OAM_SIZE);
+    state = state_put(state, gb->io, IO_SIZE);
+    state = state_put(state, gb->hram, HRAM_SIZE);
+    state = state_put(state, &gb->ie, sizeof(gb->ie));
+    state = state_put(state, &gb->cycles, sizeof(gb->cycles));
+
+    state = state_put(state, &cart->ram_enable, 1);
+    state = state_put(state, &cart->primary_bank, 1);
+    state = state_put(state, &cart->secondary_bank, 1);
+    state = state_put(state, &cart->banking_mode, 1);
+    state_put(state, cart->ram, cart->ram_size);
+}
+
+uint8_t gb_load_state(GB *gb, const uint8_t *state) {
+    GBStateHeader header;
+    Cartridge *cart = gb->cartridge;
+    Serial serial = gb->serial;
+
+    state = state_get(state, &header, sizeof(header));
+
+    if (memcmp(header.magic, GB_STATE_MAGIC, sizeof(header.magic)) != 0 || header.size != gb_state_size(gb)) {
+        fprintf(stderr, "gb_load_state(): State doesn't belong to this build or cartridge.\n");
+        return 0;
+    }
+
+    state = state_get(state, &gb->cpu, sizeof(CPU));
+    state = state_get(state, &gb->mmu, sizeof(MMU));
+    state = state_get(state, &gb->ppu, sizeof(PPU));
+    state = state_get(state, &gb->line_log, sizeof(PPULineLog));
+    state = state_get(state, &gb->apu, sizeof(APU));
+    state = state_get(state, &gb->joypad, sizeof(Joypad));
+    state = state_get(state, &gb->timer, sizeof(Timer));
+    state = state_get(state, &gb->serial, sizeof(Serial));
+
+    gb_relink(gb);
+
+    // whatever is connected to the link port stays connected
+    gb->serial.exchange = serial.exchange;
+    gb->serial.userdata = serial.userdata;
+
+    // a fork stops sharing everything that is overwritten
+    SHARED_BLOCK_WRITE(gb->framebuffer_block, gb->framebuffer);
+    SHARED_BLOCK_WRITE(gb->vram_block, gb->vram);
+    SHARED_BLOCK_WRITE(gb->wram_block, gb->wram);
+    SHARED_BLOCK_WRITE(cart->ram_block, cart->ram);
+
+    state = state_get(state, gb->framebuffer, GB_SCREEN_W * GB_SCREEN_H);
+    state = state_get(state, &gb->frame_ready, sizeof(gb->frame_ready));
+    state = state_get(state, gb->vram, VRAM_SIZE);
+    state = state_get(state, gb->wram, WRAM_SIZE);
+    state = state_get(state, gb->oam, OAM_SIZE);
+    gb->ppu.obj_table_dirty = 1;
+    state = state_get(state, gb->io, IO_SIZE);
+    state = state_get(state, gb->hram, HRAM_SIZE);
+    state = state_get(state, &gb->ie, sizeof(gb->ie));
+    state = state_get(state, &gb->cycles, sizeof(gb->cycles));
+
+    state = state_get(state, &cart->ram_enable, 1);
+    state = state_get(state, &cart->primary_bank, 1);
+    state = state_get(state, &cart->secondary_bank, 1);
+    state = state_get(state, &cart->banking_mode, 1);
+    state_get(state, cart->ram, cart->ram_size);
+
+    if (gb->state_hash != NULL) state_hash_invalidate(gb->state_hash);
+
+    return 1;
+}
+
+// hash of everything that affects emulation from here on, two
+// runs that reach the same hash continue identically
+uint64_t gb_state_hash(GB *gb) {
+    if (gb->state_hash != NULL) return state_hash_update(gb->state_hash, gb);
+
+    StateHash full;
+    state_hash_invalidate(&full);
+
+    return state_hash_update(&full, gb);
 }
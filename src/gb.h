@@ -2,6 +2,7 @@
 #define GAMEBOY_H
 
 #include <stdint.h>
+#include <stddef.h>
 
 #include "cpu.h"
 #include "mmu.h"
@@ -9,12 +10,35 @@
 #include "apu.h"
 #include "joypad.h"
 #include "timer.h"
+#include "serial.h"
 
 #include "cartridge.h"
+#include "shared_block.h"
+#include "arena.h"
 
 #define GB_SCREEN_W 160
 #define GB_SCREEN_H 144
 
+#define GB_CYCLES_PER_FRAME 17556 // M-cycles
+
+// bank reported for code running from the boot ROM
+#define GB_BOOT_BANK 0x3FF
+
+// frames the boot ROM may take before gb_run_boot() gives up
+#define GB_BOOT_MAX_FRAMES 600
+
+// what gb_skip_boot() reads from the cartridge header and the boot ROM
+#define GB_BOOT_LOGO_ADDR       0x0104
+#define GB_BOOT_LOGO_SIZE       48
+#define GB_HEADER_CHECKSUM_ADDR 0x014D
+#define GB_BOOT_REGISTERED_ADDR 0x00D8
+
+// where the PPU and the divider are when the boot ROM unmaps itself
+#define GB_BOOT_END_DOT     155
+#define GB_BOOT_END_DIVIDER 33
+
+#define GB_STATE_MAGIC "CARTSTA1"
+
 //      memory addresses:    end      start
 #define VRAM_SIZE           (0x9FFF - 0x8000 + 1)
 #define WRAM_SIZE           (0xDFFF - 0xC000 + 1)
@@ -42,35 +66,107 @@ typedef enum Interrupt {
     INTERRUPT_JOYPAD = 4
 } Interrupt;
 
+// savestates start with this header, the rest is only
+// meaningful to the same build of the emulator
+typedef struct GBStateHeader {
+    char magic[8];
+    uint32_t size;
+} GBStateHeader;
+
 typedef struct GB {
-    // main components
-    CPU cpu; 
+    // Hot state first: everything touched on every step (the
+    // components but the APU, IO, HRAM, IE and the memory pointers)
+    // shares the first few cache lines. Large or rarely used members
+    // follow, the APU comes last.
+    CPU cpu;
+    Timer timer;
     MMU mmu;
     PPU ppu;
-    APU apu;
-    Joypad joypad;
-    Timer timer;
 
-    uint8_t framebuffer[GB_SCREEN_W * GB_SCREEN_H];
+    // M-cycles since power on
+    uint64_t cycles;
+
     uint8_t frame_ready;
+    uint8_t ie;
 
     // specific memory areas
-    uint8_t vram[VRAM_SIZE];
-    uint8_t wram[WRAM_SIZE];
-    uint8_t oam[OAM_SIZE];
+    uint8_t *vram;
+    uint8_t *wram;
     uint8_t io[IO_SIZE];
     uint8_t hram[HRAM_SIZE];
-    uint8_t ie;
+    uint8_t oam[OAM_SIZE];
 
     Cartridge *cartridge;
+
+    // GB_SCREEN_W * GB_SCREEN_H shade indices
+    uint8_t *framebuffer;
+
+    Joypad joypad;
+    Serial serial;
+
+    // the blocks behind framebuffer, vram and wram, shared with forks
+    SharedBlock *framebuffer_block;
+    SharedBlock *vram_block;
+    SharedBlock *wram_block;
+
+    // the arena holding this GB, NULL unless it came from gb_clone()
+    Arena *arena;
+
+    // optional, only used when built with CART_PROFILER
+    struct Profiler *profiler;
+
+    // optional, only used when built with CART_TRACE
+    struct Trace *trace;
+
+    // optional, only used when built with CART_STATS
+    struct Stats *stats;
+
+    // optional, makes gb_state_hash() incremental
+    struct StateHash *state_hash;
+
+    // derived from OAM, see ppu_scan_oam()
+    PPUObjTable obj_table;
+
+    // mid-line register writes, see ppu_write_register()
+    PPULineLog line_log;
+
+    APU apu;
 } GB;
 
 GB *create_gb(const char *rom_file);
 
+GB *create_gb_from_rom(uint8_t *rom_buf);
+
 void destroy_gb(GB *gb);
 
-void gb_step(GB *gb);
+GB *gb_fork(GB *gb);
+
+void gb_fork_into(GB *gb, GB *fork);
+
+size_t gb_arena_size(uint32_t ram_size);
+
+GB *gb_clone(GB *gb, ArenaPool *pool);
+
+GB *create_gb_in_pool(ArenaPool *pool, const char *rom_file);
+
+uint8_t gb_step(GB *gb);
+
+void gb_run_frame(GB *gb);
+
+uint8_t gb_run_boot(GB *gb);
+
+void gb_skip_boot(GB *gb);
 
 void gb_interrupt(GB *gb, Interrupt intr);
 
+uint16_t gb_code_bank(GB *gb, uint16_t pc);
+
+size_t gb_state_size(GB *gb);
+
+void gb_save_state(GB *gb, uint8_t *state);
+
+uint8_t gb_load_state(GB *gb, const uint8_t *state);
+
+uint64_t gb_state_hash(GB *gb);
+
 #endif
@@ -0,0 +1,12 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// 64-bit non-cryptographic hash (the XXH64 algorithm), used
+// to identify ROMs and to compare emulator state between runs
+
+uint64_t hash64(const void *data, size_t len, uint64_t seed);
+
+#endif
@@ -0,0 +1,106 @@
+#include "io.h"
+
+#include <stddef.h>
+
+typedef uint8_t (*IORead)(GB *gb, uint8_t reg);
+typedef void (*IOWrite)(GB *gb, uint8_t reg, uint8_t val);
+
+// bits that always read as 1, unmapped registers read as 0xFF
+static const uint8_t IO_READ_MASKS[IO_REGISTERS] = {
+    0xC0, 0x00, 0x7E, 0xFF, 0x00, 0x00, 0x00, 0xF8, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xE0,
+    0x80, 0x3F, 0x00, 0xFF, 0xBF, 0xFF, 0x3F, 0x00, 0xFF, 0xBF, 0x7F, 0xFF, 0x9F, 0xFF, 0xBF, 0xFF,
+    0xFF, 0x00, 0x00, 0xBF, 0x00, 0x00, 0x70, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+};
+
+// the buttons may have changed since the selection was written
+static uint8_t io_read_joyp(GB *gb, uint8_t reg) {
+    joypad_update(&gb->joypad);
+    return gb->io[reg];
+}
+
+static void io_write_joyp(GB *gb, uint8_t reg, uint8_t val) {
+    gb->io[reg] = val;
+    joypad_update(&gb->joypad);
+}
+
+static void io_write_sc(GB *gb, uint8_t reg, uint8_t val) {
+    gb->io[reg] = val;
+    serial_control_write(&gb->serial, val);
+}
+
+static void io_write_div(GB *gb, uint8_t reg, uint8_t val) {
+    timer_div_reset(&gb->timer);
+}
+
+// only the five interrupt flags are stored, see cpu_handle_interrupts()
+static void io_write_if(GB *gb, uint8_t reg, uint8_t val) {
+    gb->io[reg] = val & 0x1F;
+}
+
+// the coincidence flag and the mode belong to the PPU
+static void io_write_stat(GB *gb, uint8_t reg, uint8_t val) {
+    gb->io[reg] = (val & 0x78) | (gb->io[reg] & 0x07);
+}
+
+static void io_write_read_only(GB *gb, uint8_t reg, uint8_t val) {
+}
+
+// the renderer has to know when these change mid-line
+static void io_write_ppu(GB *gb, uint8_t reg, uint8_t val) {
+    ppu_write_register(&gb->ppu, reg, val);
+}
+
+static void io_write_dma(GB *gb, uint8_t reg, uint8_t val) {
+    gb->io[reg] = val;
+    mmu_dma_transfer(&gb->mmu, val);
+}
+
+static void io_write_bank(GB *gb, uint8_t reg, uint8_t val) {
+    gb->io[reg] = val;
+    gb->mmu.bootrom_mapped = 0;
+}
+
+// registers without a handler are plain storage
+static const IORead IO_READ_HANDLERS[IO_REGISTERS] = {
+    [JOYP_ADDR - IO_BASE_ADDR] = io_read_joyp
+};
+
+static const IOWrite IO_WRITE_HANDLERS[IO_REGISTERS] = {
+    [JOYP_ADDR - IO_BASE_ADDR] = io_write_joyp,
+    [SC_ADDR_RELATIVE]         = io_write_sc,
+    [DIV_ADDR_RELATIVE]        = io_write_div,
+    [IF_ADDR_RELATIVE]         = io_write_if,
+    [LCDC_ADDR_RELATIVE]       = io_write_ppu,
+    [STAT_ADDR_RELATIVE]       = io_write_stat,
+    [SCY_ADDR_RELATIVE]        = io_write_ppu,
+    [SCX_ADDR_RELATIVE]        = io_write_ppu,
+    [LY_ADDR_RELATIVE]         = io_write_read_only,
+    [DMA_ADDR - IO_BASE_ADDR]  = io_write_dma,
+    [BGP_ADDR_RELATIVE]        = io_write_ppu,
+    [OBP0_ADDR_RELATIVE]       = io_write_ppu,
+    [OBP1_ADDR_RELATIVE]       = io_write_ppu,
+    [WY_ADDR_RELATIVE]         = io_write_ppu,
+    [WX_ADDR_RELATIVE]         = io_write_ppu,
+    [BANK_ADDR - IO_BASE_ADDR] = io_write_bank
+};
+
+// 'reg' is relative to IO_BASE_ADDR
+uint8_t io_read(GB *gb, uint8_t reg) {
+    IORead read = IO_READ_HANDLERS[reg];
+
+    uint8_t val = (read != NULL) ? read(gb, reg) : gb->io[reg];
+
+    return val | IO_READ_MASKS[reg];
+}
+
+void io_write(GB *gb, uint8_t reg, uint8_t val) {
+    IOWrite write = IO_WRITE_HANDLERS[reg];
+
+    if (write != NULL) write(gb, reg, val);
+    else gb->io[reg] = val;
+}
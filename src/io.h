@@ -0,0 +1,21 @@
+#ifndef IO_H
+#define IO_H
+
+#include <stdint.h>
+
+#include "gb.h"
+
+// Dispatch of CPU accesses to the IO registers (0xFF00-0xFF7F).
+//
+// Every register can have a read and a write handler, without one
+// the value is plainly loaded from or stored to gb->io. Unused bits
+// always read as 1 through the read masks; the stored values (which
+// the components use directly) only hold what was written.
+
+#define IO_REGISTERS 128
+
+uint8_t io_read(GB *gb, uint8_t reg);
+
+void io_write(GB *gb, uint8_t reg, uint8_t val);
+
+#endif
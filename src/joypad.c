@@ -20,6 +20,24 @@ void joypad_press(Joypad *joypad, JoypadButton button) {
     else joypad->dpad &= ~(1 << (button - JOYPAD_BUTTON_RIGHT));
 }
 
+void joypad_set(Joypad *joypad, uint8_t pressed) {
+    // bit n of 'pressed' corresponds to the JoypadButton with value n
+    uint8_t buttons = ~pressed & 0x0F;
+    uint8_t dpad = (~pressed >> 4) & 0x0F;
+
+    // only a button going from released to pressed requests the interrupt
+    if ((joypad->buttons & ~buttons) || (joypad->dpad & ~dpad))
+        gb_interrupt(joypad->gb, INTERRUPT_JOYPAD);
+
+    joypad->buttons = buttons;
+    joypad->dpad = dpad;
+}
+
+// the inverse of joypad_set()
+uint8_t joypad_get(Joypad *joypad) {
+    return (uint8_t)(~(joypad->buttons | (joypad->dpad << 4)));
+}
+
 void joypad_update(Joypad *joypad) {
     uint8_t joyp = joypad->gb->io[JOYP_ADDR - IO_BASE_ADDR] & JOYP_SELECT_MASK;
     
@@ -33,6 +33,10 @@ void joypad_reset(Joypad *joypad);
 
 void joypad_press(Joypad *joypad, JoypadButton button);
 
+void joypad_set(Joypad *joypad, uint8_t pressed);
+
+uint8_t joypad_get(Joypad *joypad);
+
 void joypad_update(Joypad *joypad);
 
 #endif
@@ -0,0 +1,359 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "link.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "state_hash.h"
+
+#ifndef _WIN32
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// a partner that went away shouldn't kill this process with SIGPIPE
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+#endif
+
+typedef enum LinkMessageType {
+    LINK_MESSAGE_SYNC,     // the sender can't complete a transfer before 'cycles'
+    LINK_MESSAGE_TRANSFER, // the sender clocked out 'data', completing at 'cycles'
+    LINK_MESSAGE_REPLY     // 'data' was shifted back for a transfer, 'cycles' as for SYNC
+} LinkMessageType;
+
+typedef struct LinkMessage {
+    uint64_t cycles;
+    uint8_t type;
+    uint8_t data;
+} LinkMessage;
+
+// M-cycles until a transfer clocked by 'gb' could complete at the
+// earliest, during its exchange those until it actually completed
+static uint16_t cycles_to_exchange(GB *gb) {
+    return (gb->serial.transfer_cycles > 0) ? gb->serial.transfer_cycles : SERIAL_TRANSFER_CYCLES;
+}
+
+static uint64_t link_time(Link *link, uint8_t side) {
+    return link->gb[side]->cycles - link->base_cycles[side];
+}
+
+static uint64_t link_next_exchange(Link *link, uint8_t side) {
+    return link_time(link, side) + cycles_to_exchange(link->gb[side]);
+}
+
+static void link_catch_up(Link *link, uint8_t side, uint64_t time) {
+    GB *gb = link->gb[side];
+
+    while (link_time(link, side) < time) gb_step(gb);
+}
+
+// runs when a transfer clocked by one side completes
+static uint8_t link_exchange(void *userdata, uint8_t out) {
+    LinkPort *port = (LinkPort*)userdata;
+    Link *link = port->link;
+    uint8_t other = port->side ^ 1;
+    uint8_t in = 0xFF;
+
+    link->exchanges++;
+
+    // when both sides clock a transfer at once (the other one completed
+    // its own while being caught up here) neither is listening
+    if (link->exchanging[other]) return in;
+
+    // the other side stopped short of the time the transfer completed,
+    // or at its first instruction boundary after it, see link.h
+    link->exchanging[port->side] = 1;
+    link_catch_up(link, other, link_next_exchange(link, port->side));
+    link->exchanging[port->side] = 0;
+
+    return serial_clock_external(&link->gb[other]->serial, out);
+}
+
+Link *create_link(GB *a, GB *b) {
+    Link *new_link = (Link*)malloc(sizeof(Link));
+
+    new_link->gb[0] = a;
+    new_link->gb[1] = b;
+    new_link->exchanges = 0;
+    new_link->exchanging[0] = 0;
+    new_link->exchanging[1] = 0;
+
+    for (uint8_t s = 0; s < 2; s++) {
+        new_link->base_cycles[s] = new_link->gb[s]->cycles;
+        new_link->ports[s] = (LinkPort){ new_link, s };
+
+        serial_set_exchange(&new_link->gb[s]->serial, link_exchange, &new_link->ports[s]);
+    }
+
+    return new_link;
+}
+
+void destroy_link(Link *link) {
+    if (link == NULL) return;
+
+    for (uint8_t s = 0; s < 2; s++) serial_set_exchange(&link->gb[s]->serial, NULL, NULL);
+
+    free(link);
+}
+
+// runs the first GB for a frame and the second one up to the same point,
+// always advancing the side behind up to the other's next possible exchange
+void link_run_frame(Link *link) {
+    GB *gb = link->gb[0];
+    uint64_t start = link_time(link, 0);
+
+    while (gb->frame_ready == 0 && link_time(link, 0) - start < GB_CYCLES_PER_FRAME) {
+        if (link_time(link, 0) <= link_time(link, 1)) {
+            uint64_t limit = link_next_exchange(link, 1);
+
+            while (gb->frame_ready == 0 && link_time(link, 0) - start < GB_CYCLES_PER_FRAME && link_time(link, 0) < limit)
+                gb_step(gb);
+        } else {
+            link_catch_up(link, 1, link_next_exchange(link, 0));
+        }
+    }
+
+    gb->frame_ready = 0;
+
+    if (gb->state_hash != NULL && gb->state_hash->hash_frames == 1)
+        gb->state_hash->frame_hash = gb_state_hash(gb);
+
+    link_catch_up(link, 1, link_time(link, 0));
+    link->gb[1]->frame_ready = 0;
+}
+
+#ifndef _WIN32
+
+static uint64_t link_socket_time(LinkSocket *sock) {
+    return sock->gb->cycles - sock->base_cycles;
+}
+
+static uint64_t link_socket_next_exchange(LinkSocket *sock) {
+    return link_socket_time(sock) + cycles_to_exchange(sock->gb);
+}
+
+static void link_socket_send(LinkSocket *sock, LinkMessageType type, uint64_t cycles, uint8_t data) {
+    LinkMessage message = { cycles, (uint8_t)type, data };
+
+    if (send(sock->fd, &message, sizeof(message), MSG_NOSIGNAL) != sizeof(message)) sock->connected = 0;
+}
+
+// tells the partner how far it may run, unless it knows already
+static void link_socket_sync(LinkSocket *sock) {
+    uint64_t next = link_socket_next_exchange(sock);
+
+    if (next == sock->sent_next) return;
+
+    sock->sent_next = next;
+    link_socket_send(sock, LINK_MESSAGE_SYNC, next, 0);
+}
+
+static uint8_t link_socket_receive(LinkSocket *sock, LinkMessage *message) {
+    size_t received = 0;
+
+    while (received < sizeof(LinkMessage)) {
+        ssize_t r = read(sock->fd, (uint8_t*)message + received, sizeof(LinkMessage) - received);
+
+        if (r <= 0) {
+            sock->connected = 0;
+            return 0;
+        }
+
+        received += (size_t)r;
+    }
+
+    return 1;
+}
+
+static void link_socket_handle(LinkSocket *sock, LinkMessage *message) {
+    switch (message->type) {
+        case LINK_MESSAGE_SYNC:
+            if (message->cycles > sock->partner_next) sock->partner_next = message->cycles;
+            break;
+
+        case LINK_MESSAGE_TRANSFER:
+            // when both sides clock a transfer at once neither
+            // is listening, so both of them shift in 0xFF
+            if (sock->waiting_reply) {
+                link_socket_send(sock, LINK_MESSAGE_REPLY, link_socket_next_exchange(sock), 0xFF);
+                break;
+            }
+
+            // the partner's next transfer starts after this one
+            sock->pending = 1;
+            sock->pending_cycles = message->cycles;
+            sock->pending_data = message->data;
+            sock->partner_next = message->cycles + SERIAL_TRANSFER_CYCLES;
+            break;
+
+        case LINK_MESSAGE_REPLY:
+            if (message->cycles > sock->partner_next) sock->partner_next = message->cycles;
+
+            sock->reply = message->data;
+            sock->waiting_reply = 0;
+            break;
+    }
+}
+
+// handles all messages that already arrived, or waits for one with 'block'
+static void link_socket_poll(LinkSocket *sock, uint8_t block) {
+    struct pollfd pfd = { sock->fd, POLLIN, 0 };
+    LinkMessage message;
+
+    while (sock->connected && poll(&pfd, 1, block ? -1 : 0) > 0) {
+        if (link_socket_receive(sock, &message) == 0) return;
+
+        link_socket_handle(sock, &message);
+        block = 0;
+    }
+}
+
+static uint8_t link_socket_exchange(void *userdata, uint8_t out) {
+    LinkSocket *sock = (LinkSocket*)userdata;
+
+    sock->waiting_reply = 1;
+    sock->reply = 0xFF;
+
+    // the partner waits for this before it gets past the transfer
+    link_socket_send(sock, LINK_MESSAGE_TRANSFER, link_socket_next_exchange(sock), out);
+
+    while (sock->waiting_reply && sock->connected) link_socket_poll(sock, 1);
+
+    sock->waiting_reply = 0;
+    sock->exchanges++;
+    return sock->reply;
+}
+
+// takes part in the partner's transfer, once this side reached it
+static void link_socket_clock_in(LinkSocket *sock) {
+    uint8_t in = serial_clock_external(&sock->gb->serial, sock->pending_data);
+
+    sock->pending = 0;
+    sock->sent_next = link_socket_next_exchange(sock);
+
+    link_socket_send(sock, LINK_MESSAGE_REPLY, sock->sent_next, in);
+}
+
+// the server waits for the partner to connect to 'path'
+LinkSocket *create_link_socket(GB *gb, const char *path, uint8_t server) {
+    struct sockaddr_un addr;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (fd < 0) {
+        fprintf(stderr, "create_link_socket(): Failed to create a socket.\n");
+        return NULL;
+    }
+
+#ifdef SO_NOSIGPIPE
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+
+    if (server) {
+        int listen_fd = fd;
+
+        unlink(path);
+
+        if (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+            listen(listen_fd, 1) != 0 ||
+            (fd = accept(listen_fd, NULL, NULL)) < 0) {
+            fprintf(stderr, "create_link_socket(): Failed to listen on: %s\n", path);
+            close(listen_fd);
+            return NULL;
+        }
+
+        close(listen_fd);
+        unlink(path);
+    } else if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "create_link_socket(): Failed to connect to: %s\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    LinkSocket *new_sock = (LinkSocket*)malloc(sizeof(LinkSocket));
+
+    new_sock->fd = fd;
+    new_sock->gb = gb;
+    new_sock->base_cycles = gb->cycles;
+    new_sock->partner_next = 0;
+    new_sock->sent_next = 0;
+    new_sock->pending = 0;
+    new_sock->pending_cycles = 0;
+    new_sock->pending_data = 0xFF;
+    new_sock->waiting_reply = 0;
+    new_sock->reply = 0xFF;
+    new_sock->connected = 1;
+    new_sock->exchanges = 0;
+
+    serial_set_exchange(&gb->serial, link_socket_exchange, new_sock);
+
+    return new_sock;
+}
+
+void destroy_link_socket(LinkSocket *sock) {
+    if (sock == NULL) return;
+
+    serial_set_exchange(&sock->gb->serial, NULL, NULL);
+
+    close(sock->fd);
+    free(sock);
+}
+
+// runs a frame like gb_run_frame(), without getting past the partner's
+// next possible exchange, returns 0 once the partner disconnected
+uint8_t link_socket_run_frame(LinkSocket *sock) {
+    GB *gb = sock->gb;
+    uint32_t cycles = 0;
+
+    while (gb->frame_ready == 0 && cycles < GB_CYCLES_PER_FRAME && sock->connected) {
+        if (sock->pending && link_socket_time(sock) >= sock->pending_cycles) {
+            link_socket_clock_in(sock);
+            continue;
+        }
+
+        uint64_t limit = sock->pending ? sock->pending_cycles : sock->partner_next;
+
+        while (gb->frame_ready == 0 && cycles < GB_CYCLES_PER_FRAME && link_socket_time(sock) < limit)
+            cycles += gb_step(gb);
+
+        if (link_socket_time(sock) < limit) {
+            link_socket_poll(sock, 0);
+        } else if (sock->pending == 0) {
+            // the partner may be waiting for this side as well
+            link_socket_sync(sock);
+            link_socket_poll(sock, 1);
+        }
+    }
+
+    gb->frame_ready = 0;
+
+    link_socket_sync(sock);
+
+    return sock->connected;
+}
+
+#else
+
+LinkSocket *create_link_socket(GB *gb, const char *path, uint8_t server) {
+    fprintf(stderr, "create_link_socket(): Unix sockets aren't supported on this platform.\n");
+    return NULL;
+}
+
+void destroy_link_socket(LinkSocket *sock) {
+}
+
+uint8_t link_socket_run_frame(LinkSocket *sock) {
+    return 0;
+}
+
+#endif
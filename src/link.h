@@ -0,0 +1,70 @@
+#ifndef LINK_H
+#define LINK_H
+
+#include <stdint.h>
+
+#include "gb.h"
+
+// Link cables between two GBs, over their serial exchange callbacks.
+//
+// Neither side is synchronized on every cycle. A side may run ahead
+// up to the earliest time its partner could complete a transfer: the
+// end of the partner's transfer in progress, or SERIAL_TRANSFER_CYCLES
+// after the partner's current time when it has none. So when a transfer
+// completes, the other side is never past it, and takes part in the
+// exchange at its first instruction boundary at or after that time.
+//
+// Link connects two instances in the same process. LinkSocket connects
+// an instance to one in another process over a Unix socket, where every
+// message carries the sender's earliest possible exchange. Both follow
+// the same rule, which doesn't depend on how the two sides are scheduled,
+// so a GB runs the same over either of them.
+
+typedef struct LinkPort {
+    struct Link *link;
+    uint8_t side;
+} LinkPort;
+
+typedef struct Link {
+    GB *gb[2];
+    uint64_t base_cycles[2];
+    LinkPort ports[2];
+    uint8_t exchanging[2];
+    uint32_t exchanges;
+} Link;
+
+typedef struct LinkSocket {
+    int fd;
+    GB *gb;
+    uint64_t base_cycles;
+
+    // the earliest the partner could complete a transfer, as of its
+    // last message, and the same for this side as last sent
+    uint64_t partner_next;
+    uint64_t sent_next;
+
+    // a transfer clocked by the partner, taken part in once this side
+    // reaches the time it completed
+    uint8_t pending;
+    uint64_t pending_cycles;
+    uint8_t pending_data;
+
+    uint8_t waiting_reply;
+    uint8_t reply;
+    uint8_t connected;
+    uint32_t exchanges; // transfers clocked by this side
+} LinkSocket;
+
+Link *create_link(GB *a, GB *b);
+
+void destroy_link(Link *link);
+
+void link_run_frame(Link *link);
+
+LinkSocket *create_link_socket(GB *gb, const char *path, uint8_t server);
+
+void destroy_link_socket(LinkSocket *sock);
+
+uint8_t link_socket_run_frame(LinkSocket *sock);
+
+#endif
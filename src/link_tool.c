@@ -0,0 +1,99 @@
+#include "link.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+// cart_link - runs two GBs connected with a link cable, headless
+//
+// usage: cart_link <rom a> <rom b> [frames]
+//        cart_link -l <socket> <rom> [frames]
+//        cart_link -c <socket> <rom> [frames]
+//
+// The first form runs both in this process, the others run one side
+// each in two processes, one listening on the socket and one connecting.
+
+#define DEFAULT_FRAMES 3600
+
+static void print_result(GB *gb, const char *name, uint32_t frames, uint32_t exchanges, uint64_t elapsed) {
+    printf(
+            "%s: %u frames, %u exchanges in %.1f ms, state %016llx\n",
+            name,
+            frames,
+            exchanges,
+            (double)elapsed / 1e6,
+            (unsigned long long)gb_state_hash(gb)
+    );
+}
+
+static int run_local(const char *rom_a, const char *rom_b, uint32_t frames) {
+    GB *a = create_gb(rom_a);
+    GB *b = create_gb(rom_b);
+
+    if (a == NULL || b == NULL) {
+        destroy_gb(a);
+        destroy_gb(b);
+        return -1;
+    }
+
+    Link *link = create_link(a, b);
+    uint64_t start = get_time_ns();
+
+    for (uint32_t f = 0; f < frames; f++) link_run_frame(link);
+
+    uint64_t elapsed = get_time_ns() - start;
+
+    print_result(a, "a", frames, link->exchanges, elapsed);
+    print_result(b, "b", frames, link->exchanges, elapsed);
+
+    destroy_link(link);
+    destroy_gb(a);
+    destroy_gb(b);
+    return 0;
+}
+
+static int run_socket(const char *path, const char *rom, uint32_t frames, uint8_t server) {
+    GB *gb = create_gb(rom);
+
+    if (gb == NULL) return -1;
+
+    LinkSocket *sock = create_link_socket(gb, path, server);
+
+    if (sock == NULL) {
+        destroy_gb(gb);
+        return -1;
+    }
+
+    uint64_t start = get_time_ns();
+    uint32_t f = 0;
+
+    while (f < frames && link_socket_run_frame(sock)) f++;
+
+    uint64_t elapsed = get_time_ns() - start;
+
+    // the partner may have finished and disconnected first
+    print_result(gb, server ? "server" : "client", f, sock->exchanges, elapsed);
+
+    destroy_link_socket(sock);
+    destroy_gb(gb);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc >= 4 && (strcmp(argv[1], "-l") == 0 || strcmp(argv[1], "-c") == 0))
+        return run_socket(
+                argv[2],
+                argv[3],
+                (argc >= 5) ? (uint32_t)atoi(argv[4]) : DEFAULT_FRAMES,
+                strcmp(argv[1], "-l") == 0
+        );
+
+    if (argc >= 3 && argv[1][0] != '-')
+        return run_local(argv[1], argv[2], (argc >= 4) ? (uint32_t)atoi(argv[3]) : DEFAULT_FRAMES);
+
+    fprintf(stderr, "usage: %s <rom a> <rom b> [frames]\n", argv[0]);
+    fprintf(stderr, "       %s -l <socket> <rom> [frames]\n", argv[0]);
+    fprintf(stderr, "       %s -c <socket> <rom> [frames]\n", argv[0]);
+    return -1;
+}
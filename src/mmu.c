@@ -1,7 +1,12 @@
 #include "mmu.h"
 
+#include <string.h>
+
 #include "gb.h"
+#include "io.h"
 #include "bootrom.h"
+#include "stats.h"
+#include "state_hash.h"
 
 void mmu_init(MMU *mmu, struct GB *gb) {
     *mmu = (MMU){
@@ -13,6 +18,9 @@ void mmu_init(MMU *mmu, struct GB *gb) {
 uint8_t mmu_read(MMU *mmu, uint16_t addr) {
     uint8_t val = 0xFF;
 
+    // the bus is taken by OAM DMA
+    if (mmu->dma_cycles > 0 && addr < IO_BASE_ADDR) return val;
+
     switch (addr & 0xF000) {
         case 0x0000:
             if (mmu->bootrom_mapped == 1 && addr < 0x0100) {
@@ -26,6 +34,7 @@ uint8_t mmu_read(MMU *mmu, uint16_t addr) {
         case 0x5000:
         case 0x6000:
         case 0x7000:
+            STATS_COUNT(mmu->gb->stats, STATS_COUNTER_MMU_SLOW_READS);
             val = cartridge_read(mmu->gb->cartridge, addr); break;
 
         case 0x8000:
@@ -34,6 +43,7 @@ uint8_t mmu_read(MMU *mmu, uint16_t addr) {
 
         case 0xA000:
         case 0xB000:
+            STATS_COUNT(mmu->gb->stats, STATS_COUNTER_MMU_SLOW_READS);
             val = cartridge_read(mmu->gb->cartridge, addr); break;
 
         case 0xC000:
@@ -48,8 +58,10 @@ uint8_t mmu_read(MMU *mmu, uint16_t addr) {
                 val = mmu->gb->oam[addr - OAM_BASE_ADDR];
             else if (addr <= 0xFEFF)
                 break;
-            else if (addr <= 0xFF7F)
-                val = mmu->gb->io[addr - IO_BASE_ADDR];
+            else if (addr <= 0xFF7F) {
+                STATS_COUNT(mmu->gb->stats, STATS_COUNTER_MMU_SLOW_READS);
+                val = io_read(mmu->gb, addr - IO_BASE_ADDR);
+            }
             else if (addr <= 0xFFFE)
                 val = mmu->gb->hram[addr - HRAM_BASE_ADDR];
             else
@@ -60,6 +72,8 @@ uint8_t mmu_read(MMU *mmu, uint16_t addr) {
 }
 
 void mmu_write(MMU *mmu, uint16_t addr, uint8_t val) {
+    if (mmu->dma_cycles > 0 && addr < IO_BASE_ADDR) return;
+
     switch (addr & 0xF000) {
         case 0x0000:
         case 0x1000:
@@ -73,32 +87,37 @@ void mmu_write(MMU *mmu, uint16_t addr, uint8_t val) {
 
         case 0x8000:
         case 0x9000:
+            STATE_HASH_MARK(mmu->gb, STATE_HASH_VRAM_PAGE + (addr - VRAM_BASE_ADDR) / STATE_HASH_PAGE_SIZE);
+            SHARED_BLOCK_WRITE(mmu->gb->vram_block, mmu->gb->vram);
             mmu->gb->vram[addr - VRAM_BASE_ADDR] = val; break;
 
         case 0xA000:
         case 0xB000:
+            STATE_HASH_MARK_SRAM(mmu->gb);
             cartridge_write(mmu->gb->cartridge, addr, val); break;
 
         case 0xC000:
         case 0xD000:
+            STATE_HASH_MARK(mmu->gb, STATE_HASH_WRAM_PAGE + (addr - WRAM_BASE_ADDR) / STATE_HASH_PAGE_SIZE);
+            SHARED_BLOCK_WRITE(mmu->gb->wram_block, mmu->gb->wram);
             mmu->gb->wram[addr - WRAM_BASE_ADDR] = val; break;
 
         case 0xE000:
         case 0xF000: 
-            if (addr <= 0xFDFF)
+            if (addr <= 0xFDFF) {
+                STATE_HASH_MARK(mmu->gb, STATE_HASH_WRAM_PAGE + (addr - WRAM_ECHO_BASE_ADDR) / STATE_HASH_PAGE_SIZE);
+                SHARED_BLOCK_WRITE(mmu->gb->wram_block, mmu->gb->wram);
                 mmu->gb->wram[addr - WRAM_ECHO_BASE_ADDR] = val;
-            else if (addr <= 0xFE9F)
+            }
+            else if (addr <= 0xFE9F) {
+                STATE_HASH_MARK(mmu->gb, STATE_HASH_OAM_PAGE);
                 mmu->gb->oam[addr - OAM_BASE_ADDR] = val;
+                mmu->gb->ppu.obj_table_dirty = 1;
+            }
             else if (addr <= 0xFEFF)
                 return;
-            else if (addr <= 0xFF7F) {
-                mmu->gb->io[addr - IO_BASE_ADDR] = val;
-
-                if (addr == JOYP_ADDR) joypad_update(&mmu->gb->joypad);
-                else if (addr == DIV_ADDR) timer_div_reset(&mmu->gb->timer);
-                else if (addr == DMA_ADDR) mmu_dma_transfer(mmu, val);
-                else if (addr == BANK_ADDR) mmu->bootrom_mapped = 0;
-            }
+            else if (addr <= 0xFF7F)
+                io_write(mmu->gb, addr - IO_BASE_ADDR, val);
             else if (addr <= 0xFFFE)
                 mmu->gb->hram[addr - HRAM_BASE_ADDR] = val;
             else
@@ -106,11 +125,59 @@ void mmu_write(MMU *mmu, uint16_t addr, uint8_t val) {
     }
 }
 
+// starts an OAM DMA from 'start' * 0x100, OAM is written when it's done
 void mmu_dma_transfer(MMU *mmu, uint8_t start) {
     if (start > 0xDF) return;
 
-    uint16_t src = start << 8;
-    //printf("transfer src: %x\n", src);
-    for (uint8_t b = 0; b < OAM_SIZE; b++)
-        mmu->gb->oam[b] = mmu_read(mmu, src + b);
+    STATS_COUNT(mmu->gb->stats, STATS_COUNTER_DMA_TRANSFERS);
+
+    mmu->dma_cycles = DMA_CYCLES;
+    mmu->dma_source = start;
+    mmu->dma_starting = 1;
+}
+
+// copies the whole source at once, plain memory
+// with memcpy() and the cartridge through its MBC
+static void mmu_dma_finish(MMU *mmu) {
+    GB *gb = mmu->gb;
+    uint16_t src = (uint16_t)mmu->dma_source << 8;
+
+    STATE_HASH_MARK(gb, STATE_HASH_OAM_PAGE);
+    gb->ppu.obj_table_dirty = 1;
+
+    switch (src & 0xF000) {
+        case 0x8000:
+        case 0x9000:
+            memcpy(gb->oam, gb->vram + (src - VRAM_BASE_ADDR), OAM_SIZE); break;
+
+        case 0xC000:
+        case 0xD000:
+            memcpy(gb->oam, gb->wram + (src - WRAM_BASE_ADDR), OAM_SIZE); break;
+
+        default:
+            if (src == 0x0000 && mmu->bootrom_mapped == 1) {
+                memcpy(gb->oam, DMG_BOOTROM, OAM_SIZE);
+                break;
+            }
+
+            for (uint8_t b = 0; b < OAM_SIZE; b++)
+                gb->oam[b] = cartridge_read(gb->cartridge, src + b);
+    }
+}
+
+void mmu_step(MMU *mmu, uint8_t cycles) {
+    if (mmu->dma_cycles == 0) return;
+
+    if (mmu->dma_starting == 1) {
+        mmu->dma_starting = 0;
+        return;
+    }
+
+    if (cycles < mmu->dma_cycles) {
+        mmu->dma_cycles -= cycles;
+        return;
+    }
+
+    mmu->dma_cycles = 0;
+    mmu_dma_finish(mmu);
 }
@@ -6,8 +6,17 @@
 #define DMA_ADDR 0xFF46
 #define BANK_ADDR 0xFF50
 
+#define DMA_CYCLES 160 // M-cycles, one per byte
+
 typedef struct MMU {
     uint8_t bootrom_mapped;
+
+    // M-cycles left of the OAM DMA in progress, 0 when idle;
+    // the CPU can only reach IO, HRAM and IE in the meantime
+    uint8_t dma_cycles;
+    uint8_t dma_source;   // high byte of the source address
+    uint8_t dma_starting; // the transfer begins after the instruction that wrote DMA
+
     struct GB *gb;
 } MMU;
 
@@ -16,6 +25,8 @@ void mmu_init(MMU *mmu, struct GB *gb);
 uint8_t mmu_read(MMU *mmu, uint16_t addr);
 void mmu_write(MMU *mmu, uint16_t addr, uint8_t val);
 
+void mmu_step(MMU *mmu, uint8_t cycles);
+
 void mmu_dma_transfer(MMU *mmu, uint8_t start);
 
 #endif
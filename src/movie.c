@@ -0,0 +1,205 @@
+#include "movie.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "hash.h"
+#include "util.h"
+
+#define INITIAL_FRAMES 4096
+
+static uint64_t rom_hash(GB *gb) {
+    return hash64(gb->cartridge->rom, gb->cartridge->rom_size, 0);
+}
+
+static MovieCheckpoint take_checkpoint(Movie *movie, GB *gb) {
+    return (MovieCheckpoint){
+        .frame = movie->num_frames,
+        .cycles = gb->cycles,
+        .framebuffer_hash = hash64(gb->framebuffer, GB_SCREEN_W * GB_SCREEN_H, 0),
+        .state_hash = gb_state_hash(gb)
+    };
+}
+
+static Movie *alloc_movie(uint32_t state_size, uint32_t inputs_capacity, uint32_t checkpoints_capacity) {
+    Movie *new_movie = (Movie*)malloc(sizeof(Movie));
+
+    new_movie->start_state = (uint8_t*)malloc(state_size);
+    new_movie->state_size = state_size;
+
+    new_movie->inputs = (uint8_t*)malloc(inputs_capacity + 1);
+    new_movie->num_frames = 0;
+    new_movie->inputs_capacity = inputs_capacity;
+
+    new_movie->checkpoints = (MovieCheckpoint*)malloc((checkpoints_capacity + 1) * sizeof(MovieCheckpoint));
+    new_movie->num_checkpoints = 0;
+    new_movie->checkpoints_capacity = checkpoints_capacity;
+
+    return new_movie;
+}
+
+// starts recording from the current state of 'gb'
+Movie *create_movie(GB *gb, uint32_t checkpoint_interval) {
+    Movie *new_movie = alloc_movie((uint32_t)gb_state_size(gb), INITIAL_FRAMES, INITIAL_FRAMES);
+
+    new_movie->rom_hash = rom_hash(gb);
+    new_movie->checkpoint_interval = MAX(checkpoint_interval, 1);
+
+    gb_save_state(gb, new_movie->start_state);
+
+    return new_movie;
+}
+
+Movie *create_movie_from_file(const char *movie_file) {
+    FILE *file = fopen(movie_file, "rb");
+
+    if (file == NULL) {
+        fprintf(stderr, "create_movie_from_file(): Failed to open file: %s\n", movie_file);
+        return NULL;
+    }
+
+    MovieHeader header;
+
+    if (fread(&header, sizeof(MovieHeader), 1, file) != 1 ||
+        memcmp(header.magic, MOVIE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.checkpoint_interval == 0) {
+        fprintf(stderr, "create_movie_from_file(): Not a movie file: %s\n", movie_file);
+        fclose(file);
+        return NULL;
+    }
+
+    Movie *new_movie = alloc_movie(header.state_size, header.num_frames, header.num_checkpoints);
+
+    new_movie->rom_hash = header.rom_hash;
+    new_movie->num_frames = header.num_frames;
+    new_movie->num_checkpoints = header.num_checkpoints;
+    new_movie->checkpoint_interval = header.checkpoint_interval;
+
+    size_t read = fread(new_movie->start_state, 1, header.state_size, file)
+        + fread(new_movie->inputs, 1, header.num_frames, file)
+        + fread(new_movie->checkpoints, sizeof(MovieCheckpoint), header.num_checkpoints, file) * sizeof(MovieCheckpoint);
+
+    fclose(file);
+
+    if (read != header.state_size + header.num_frames + header.num_checkpoints * sizeof(MovieCheckpoint)) {
+        fprintf(stderr, "create_movie_from_file(): Movie file is truncated: %s\n", movie_file);
+        destroy_movie(new_movie);
+        return NULL;
+    }
+
+    return new_movie;
+}
+
+void destroy_movie(Movie *movie) {
+    if (movie == NULL) return;
+
+    free(movie->start_state);
+    free(movie->inputs);
+    free(movie->checkpoints);
+    free(movie);
+}
+
+// has to be called after every gb_run_frame() while recording,
+// before any new input is applied
+void movie_record_frame(Movie *movie, GB *gb) {
+    if (movie->num_frames == movie->inputs_capacity) {
+        movie->inputs_capacity *= 2;
+        movie->inputs = (uint8_t*)realloc(movie->inputs, movie->inputs_capacity);
+    }
+
+    movie->inputs[movie->num_frames++] = joypad_get(&gb->joypad);
+
+    if (movie->num_frames % movie->checkpoint_interval != 0) return;
+
+    if (movie->num_checkpoints == movie->checkpoints_capacity) {
+        movie->checkpoints_capacity *= 2;
+        movie->checkpoints = (MovieCheckpoint*)realloc(
+                movie->checkpoints,
+                movie->checkpoints_capacity * sizeof(MovieCheckpoint)
+        );
+    }
+
+    movie->checkpoints[movie->num_checkpoints++] = take_checkpoint(movie, gb);
+}
+
+uint8_t movie_write(Movie *movie, const char *filename) {
+    FILE *file = fopen(filename, "wb");
+
+    if (file == NULL) {
+        fprintf(stderr, "movie_write(): Failed to open file: %s\n", filename);
+        return 0;
+    }
+
+    MovieHeader header = {
+        .magic = MOVIE_MAGIC,
+        .rom_hash = movie->rom_hash,
+        .state_size = movie->state_size,
+        .num_frames = movie->num_frames,
+        .num_checkpoints = movie->num_checkpoints,
+        .checkpoint_interval = movie->checkpoint_interval
+    };
+
+    fwrite(&header, sizeof(MovieHeader), 1, file);
+    fwrite(movie->start_state, 1, movie->state_size, file);
+    fwrite(movie->inputs, 1, movie->num_frames, file);
+    fwrite(movie->checkpoints, sizeof(MovieCheckpoint), movie->num_checkpoints, file);
+
+    fclose(file);
+    return 1;
+}
+
+// replays the whole movie on 'gb' as fast as possible,
+// returns 1 when every checkpoint matched
+uint8_t movie_play(Movie *movie, GB *gb) {
+    if (rom_hash(gb) != movie->rom_hash) {
+        fprintf(stderr, "movie_play(): Movie was recorded with a different ROM.\n");
+        return 0;
+    }
+
+    if (movie->state_size != gb_state_size(gb) || gb_load_state(gb, movie->start_state) == 0)
+        return 0;
+
+    uint32_t next_checkpoint = 0;
+    uint8_t result = 1;
+
+    Movie replay = *movie;
+    replay.num_frames = 0;
+
+    while (replay.num_frames < movie->num_frames && result == 1) {
+        uint32_t frame = replay.num_frames;
+        uint8_t checked = (frame + 1) % movie->checkpoint_interval == 0;
+
+        // only frames that are compared have to be drawn
+        ppu_set_render_enable(&gb->ppu, checked);
+
+        joypad_set(&gb->joypad, movie->inputs[frame]);
+        gb_run_frame(gb);
+
+        replay.num_frames++;
+
+        if (!checked || next_checkpoint >= movie->num_checkpoints) continue;
+
+        MovieCheckpoint expected = movie->checkpoints[next_checkpoint++];
+        MovieCheckpoint actual = take_checkpoint(&replay, gb);
+
+        if (memcmp(&expected, &actual, sizeof(MovieCheckpoint)) != 0) {
+            fprintf(
+                    stderr,
+                    "movie_play(): Replay diverged by frame %llu (cycles %llu/%llu, framebuffer %016llx/%016llx, state %016llx/%016llx).\n",
+                    (unsigned long long)actual.frame,
+                    (unsigned long long)actual.cycles,
+                    (unsigned long long)expected.cycles,
+                    (unsigned long long)actual.framebuffer_hash,
+                    (unsigned long long)expected.framebuffer_hash,
+                    (unsigned long long)actual.state_hash,
+                    (unsigned long long)expected.state_hash
+            );
+            result = 0;
+        }
+    }
+
+    ppu_set_render_enable(&gb->ppu, 1);
+
+    return result;
+}
@@ -0,0 +1,67 @@
+#ifndef MOVIE_H
+#define MOVIE_H
+
+#include <stdint.h>
+
+#include "gb.h"
+
+// Input movies: the joypad state of every frame, recorded from a
+// starting savestate, plus periodic checkpoints to verify a replay.
+//
+// A frame is one gb_run_frame() call and input only ever changes
+// between frames, so replaying the inputs on the starting state
+// reproduces the run exactly.
+
+#define MOVIE_MAGIC "CARTMOV3"
+
+#define MOVIE_CHECKPOINT_FRAMES 60
+
+typedef struct MovieCheckpoint {
+    uint64_t frame; // frames run before the checkpoint was taken
+    uint64_t cycles;
+    uint64_t framebuffer_hash;
+    uint64_t state_hash;
+} MovieCheckpoint;
+
+// movie files are this header followed by the starting state,
+// one joypad byte per frame and the checkpoints, in the byte
+// order of the machine that wrote them
+typedef struct MovieHeader {
+    char magic[8];
+    uint64_t rom_hash;
+    uint32_t state_size;
+    uint32_t num_frames;
+    uint32_t num_checkpoints;
+    uint32_t checkpoint_interval;
+} MovieHeader;
+
+typedef struct Movie {
+    uint64_t rom_hash;
+
+    uint8_t *start_state;
+    uint32_t state_size;
+
+    // bit n is set while the JoypadButton with value n is pressed
+    uint8_t *inputs;
+    uint32_t num_frames;
+    uint32_t inputs_capacity;
+
+    MovieCheckpoint *checkpoints;
+    uint32_t num_checkpoints;
+    uint32_t checkpoints_capacity;
+    uint32_t checkpoint_interval;
+} Movie;
+
+Movie *create_movie(GB *gb, uint32_t checkpoint_interval);
+
+Movie *create_movie_from_file(const char *movie_file);
+
+void destroy_movie(Movie *movie);
+
+void movie_record_frame(Movie *movie, GB *gb);
+
+uint8_t movie_write(Movie *movie, const char *filename);
+
+uint8_t movie_play(Movie *movie, GB *gb);
+
+#endif
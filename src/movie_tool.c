@@ -0,0 +1,76 @@
+#include "movie.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "util.h"
+
+// cart_movie - replays movies recorded with CART_RECORD=1, headless and unthrottled
+//
+// usage: cart_movie play <rom> <movie>
+//        cart_movie info <movie>
+
+#define NS_PER_FRAME 16742706ULL // 70224 dots at 4.194304 MHz
+
+static int play(const char *rom_file, const char *movie_file) {
+    Movie *movie = create_movie_from_file(movie_file);
+
+    if (movie == NULL) return -1;
+
+    GB *gb = create_gb(rom_file);
+
+    if (gb == NULL) {
+        destroy_movie(movie);
+        return -1;
+    }
+
+    uint64_t start = get_time_ns();
+    uint8_t matched = movie_play(movie, gb);
+    uint64_t elapsed = get_time_ns() - start;
+
+    if (elapsed == 0) elapsed = 1;
+
+    printf(
+            "%s: %u frames, %u checkpoints in %.1f ms (%.1fx real time)\n",
+            matched ? "match" : "MISMATCH",
+            movie->num_frames,
+            movie->num_checkpoints,
+            (double)elapsed / 1e6,
+            (double)movie->num_frames * NS_PER_FRAME / (double)elapsed
+    );
+
+    destroy_gb(gb);
+    destroy_movie(movie);
+    return matched ? 0 : 1;
+}
+
+static int info(const char *movie_file) {
+    Movie *movie = create_movie_from_file(movie_file);
+
+    if (movie == NULL) return -1;
+
+    uint32_t changes = 0;
+
+    for (uint32_t f = 1; f < movie->num_frames; f++)
+        if (movie->inputs[f] != movie->inputs[f - 1]) changes++;
+
+    printf("rom hash:    %016llx\n", (unsigned long long)movie->rom_hash);
+    printf("frames:      %u\n", movie->num_frames);
+    printf("input edges: %u\n", changes);
+    printf("checkpoints: %u (every %u frames)\n", movie->num_checkpoints, movie->checkpoint_interval);
+    printf("state size:  %u bytes\n", movie->state_size);
+
+    destroy_movie(movie);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc >= 4 && strcmp(argv[1], "play") == 0) return play(argv[2], argv[3]);
+
+    if (argc >= 3 && strcmp(argv[1], "info") == 0) return info(argv[2]);
+
+    fprintf(stderr, "usage: %s play <rom> <movie>\n", argv[0]);
+    fprintf(stderr, "       %s info <movie>\n", argv[0]);
+    return -1;
+}
@@ -0,0 +1,245 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "net.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "util.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#define LOOPBACK_QUEUE_SIZE 1024 // has to be a power of 2
+
+// packets on their way to one end of the loopback
+typedef struct LoopbackQueue {
+    NetPacket packets[LOOPBACK_QUEUE_SIZE];
+    uint32_t head;
+    uint32_t tail;
+} LoopbackQueue;
+
+// both ends live in the same thread
+typedef struct Loopback {
+    LoopbackQueue queues[2];
+    uint8_t open_ends;
+} Loopback;
+
+typedef struct LoopbackEnd {
+    Loopback *loopback;
+    uint8_t side;
+} LoopbackEnd;
+
+static NetTransport *create_net_transport(void *impl) {
+    NetTransport *new_transport = (NetTransport*)malloc(sizeof(NetTransport));
+
+    new_transport->impl = impl;
+    new_transport->latency_ms = 0;
+    new_transport->jitter_ms = 0;
+    new_transport->rng_state = 0x12345678;
+    new_transport->delayed = NULL;
+    new_transport->num_delayed = 0;
+
+    return new_transport;
+}
+
+static uint8_t loopback_send(NetTransport *transport, const uint8_t *data, uint32_t len) {
+    LoopbackEnd *end = (LoopbackEnd*)transport->impl;
+    LoopbackQueue *queue = &end->loopback->queues[end->side ^ 1];
+
+    if (queue->tail - queue->head == LOOPBACK_QUEUE_SIZE) return 0; // dropped
+
+    NetPacket *packet = &queue->packets[queue->tail++ & (LOOPBACK_QUEUE_SIZE - 1)];
+
+    packet->len = len;
+    memcpy(packet->data, data, len);
+
+    return 1;
+}
+
+static uint32_t loopback_receive(NetTransport *transport, uint8_t *data, uint32_t max_len) {
+    LoopbackEnd *end = (LoopbackEnd*)transport->impl;
+    LoopbackQueue *queue = &end->loopback->queues[end->side];
+
+    if (queue->head == queue->tail) return 0;
+
+    NetPacket *packet = &queue->packets[queue->head++ & (LOOPBACK_QUEUE_SIZE - 1)];
+    uint32_t len = MIN(packet->len, max_len);
+
+    memcpy(data, packet->data, len);
+
+    return len;
+}
+
+static void loopback_close(NetTransport *transport) {
+    LoopbackEnd *end = (LoopbackEnd*)transport->impl;
+
+    if (--end->loopback->open_ends == 0) free(end->loopback);
+
+    free(end);
+}
+
+// two transports connected to each other in this process
+void create_loopback_transports(NetTransport *ends[2]) {
+    Loopback *loopback = (Loopback*)calloc(1, sizeof(Loopback));
+
+    loopback->open_ends = 2;
+
+    for (uint8_t s = 0; s < 2; s++) {
+        LoopbackEnd *end = (LoopbackEnd*)malloc(sizeof(LoopbackEnd));
+
+        *end = (LoopbackEnd){ loopback, s };
+
+        ends[s] = create_net_transport(end);
+        ends[s]->send = loopback_send;
+        ends[s]->receive = loopback_receive;
+        ends[s]->close = loopback_close;
+    }
+}
+
+#ifndef _WIN32
+
+typedef struct UnixSocket {
+    int fd;
+    struct sockaddr_un remote;
+    char local_path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+} UnixSocket;
+
+static uint8_t unix_send(NetTransport *transport, const uint8_t *data, uint32_t len) {
+    UnixSocket *sock = (UnixSocket*)transport->impl;
+
+    return sendto(sock->fd, data, len, 0, (struct sockaddr*)&sock->remote, sizeof(sock->remote)) == (ssize_t)len;
+}
+
+static uint32_t unix_receive(NetTransport *transport, uint8_t *data, uint32_t max_len) {
+    UnixSocket *sock = (UnixSocket*)transport->impl;
+
+    ssize_t len = recv(sock->fd, data, max_len, 0);
+
+    return (len > 0) ? (uint32_t)len : 0;
+}
+
+static void unix_close(NetTransport *transport) {
+    UnixSocket *sock = (UnixSocket*)transport->impl;
+
+    close(sock->fd);
+    unlink(sock->local_path);
+    free(sock);
+}
+
+// a Unix datagram socket bound to 'local_path' that sends to 'remote_path'
+NetTransport *create_unix_transport(const char *local_path, const char *remote_path) {
+    struct sockaddr_un local;
+
+    memset(&local, 0, sizeof(local));
+    local.sun_family = AF_UNIX;
+    snprintf(local.sun_path, sizeof(local.sun_path), "%s", local_path);
+
+    int fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+
+    unlink(local_path);
+
+    if (fd < 0 || bind(fd, (struct sockaddr*)&local, sizeof(local)) != 0) {
+        fprintf(stderr, "create_unix_transport(): Failed to bind: %s\n", local_path);
+        if (fd >= 0) close(fd);
+        return NULL;
+    }
+
+    // receiving never waits
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    UnixSocket *sock = (UnixSocket*)malloc(sizeof(UnixSocket));
+
+    sock->fd = fd;
+    memset(&sock->remote, 0, sizeof(sock->remote));
+    sock->remote.sun_family = AF_UNIX;
+    snprintf(sock->remote.sun_path, sizeof(sock->remote.sun_path), "%s", remote_path);
+    snprintf(sock->local_path, sizeof(sock->local_path), "%s", local_path);
+
+    NetTransport *new_transport = create_net_transport(sock);
+
+    new_transport->send = unix_send;
+    new_transport->receive = unix_receive;
+    new_transport->close = unix_close;
+
+    return new_transport;
+}
+
+#else
+
+NetTransport *create_unix_transport(const char *local_path, const char *remote_path) {
+    fprintf(stderr, "create_unix_transport(): Unix sockets aren't supported on this platform.\n");
+    return NULL;
+}
+
+#endif
+
+void destroy_net_transport(NetTransport *transport) {
+    if (transport == NULL) return;
+
+    transport->close(transport);
+
+    free(transport->delayed);
+    free(transport);
+}
+
+void net_set_latency(NetTransport *transport, uint32_t latency_ms, uint32_t jitter_ms) {
+    transport->latency_ms = latency_ms;
+    transport->jitter_ms = jitter_ms;
+
+    if (transport->delayed == NULL)
+        transport->delayed = (NetPacket*)malloc(NET_MAX_DELAYED * sizeof(NetPacket));
+}
+
+uint8_t net_send(NetTransport *transport, const uint8_t *data, uint32_t len) {
+    if (len > NET_MAX_PACKET) return 0;
+
+    return transport->send(transport, data, len);
+}
+
+// returns the length of the next packet that arrived, 0 if there is none
+uint32_t net_receive(NetTransport *transport, uint8_t *data, uint32_t max_len) {
+    if (transport->delayed == NULL) return transport->receive(transport, data, max_len);
+
+    uint64_t now = get_time_ns();
+
+    // everything that arrived is held back for latency + random jitter
+    while (transport->num_delayed < NET_MAX_DELAYED) {
+        NetPacket *packet = &transport->delayed[transport->num_delayed];
+
+        packet->len = transport->receive(transport, packet->data, NET_MAX_PACKET);
+
+        if (packet->len == 0) break;
+
+        uint32_t delay_ms = transport->latency_ms;
+
+        if (transport->jitter_ms > 0) {
+            transport->rng_state = transport->rng_state * 1103515245 + 12345;
+            delay_ms += (transport->rng_state >> 16) % (transport->jitter_ms + 1);
+        }
+
+        packet->deliver_ns = now + (uint64_t)delay_ms * 1000000;
+        transport->num_delayed++;
+    }
+
+    uint32_t next = transport->num_delayed;
+
+    for (uint32_t p = 0; p < transport->num_delayed; p++)
+        if (transport->delayed[p].deliver_ns <= now &&
+            (next == transport->num_delayed || transport->delayed[p].deliver_ns < transport->delayed[next].deliver_ns))
+            next = p;
+
+    if (next == transport->num_delayed) return 0;
+
+    uint32_t len = MIN(transport->delayed[next].len, max_len);
+    memcpy(data, transport->delayed[next].data, len);
+
+    transport->delayed[next] = transport->delayed[--transport->num_delayed];
+
+    return len;
+}
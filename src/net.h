@@ -0,0 +1,48 @@
+#ifndef NET_H
+#define NET_H
+
+#include <stdint.h>
+
+// Datagram transports for netplay.
+//
+// A NetTransport sends and receives whole packets without any delivery
+// guarantee. Implementations only provide the raw operations. Latency
+// and jitter can be added on top of any of them for testing, and are
+// applied to received packets, which may then also arrive reordered.
+
+#define NET_MAX_PACKET  256
+#define NET_MAX_DELAYED 1024
+
+typedef struct NetPacket {
+    uint64_t deliver_ns;
+    uint32_t len;
+    uint8_t data[NET_MAX_PACKET];
+} NetPacket;
+
+typedef struct NetTransport {
+    uint8_t (*send)(struct NetTransport *transport, const uint8_t *data, uint32_t len);
+    uint32_t (*receive)(struct NetTransport *transport, uint8_t *data, uint32_t max_len);
+    void (*close)(struct NetTransport *transport);
+    void *impl;
+
+    // artificial latency for received packets
+    uint32_t latency_ms;
+    uint32_t jitter_ms;
+    uint32_t rng_state;
+    NetPacket *delayed;
+    uint32_t num_delayed;
+} NetTransport;
+
+void create_loopback_transports(NetTransport *ends[2]);
+
+NetTransport *create_unix_transport(const char *local_path, const char *remote_path);
+
+void destroy_net_transport(NetTransport *transport);
+
+void net_set_latency(NetTransport *transport, uint32_t latency_ms, uint32_t jitter_ms);
+
+uint8_t net_send(NetTransport *transport, const uint8_t *data, uint32_t len);
+
+uint32_t net_receive(NetTransport *transport, uint8_t *data, uint32_t max_len);
+
+#endif
@@ -0,0 +1,197 @@
+#include "netplay.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "util.h"
+
+#define NO_ROLLBACK UINT32_MAX
+
+// a packet carries the latest local inputs, older ones are repeated
+// so that a lost or reordered packet is covered by the next one
+typedef struct NetplayPacket {
+    uint32_t first_frame;
+    uint8_t num_inputs;
+    uint8_t inputs[NETPLAY_SNAPSHOTS];
+} NetplayPacket;
+
+static uint8_t *netplay_snapshot(Netplay *netplay, uint32_t frame) {
+    return netplay->snapshots[frame % NETPLAY_SNAPSHOTS];
+}
+
+static void netplay_save(Netplay *netplay, uint32_t frame) {
+    uint64_t start = get_time_ns();
+    uint8_t *snapshot = netplay_snapshot(netplay, frame);
+
+    gb_save_state(netplay->gb[0], snapshot);
+    gb_save_state(netplay->gb[1], snapshot + gb_state_size(netplay->gb[0]));
+
+    netplay->stats.save_ns += get_time_ns() - start;
+    netplay->stats.saves++;
+}
+
+static void netplay_load(Netplay *netplay, uint32_t frame) {
+    uint64_t start = get_time_ns();
+    uint8_t *snapshot = netplay_snapshot(netplay, frame);
+
+    gb_load_state(netplay->gb[0], snapshot);
+    gb_load_state(netplay->gb[1], snapshot + gb_state_size(netplay->gb[0]));
+
+    netplay->stats.load_ns += get_time_ns() - start;
+    netplay->stats.loads++;
+}
+
+static uint8_t netplay_remote_input(Netplay *netplay, uint32_t frame) {
+    uint32_t slot = frame & (NETPLAY_INPUT_RING - 1);
+
+    if (netplay->remote_tags[slot] == frame) return netplay->remote_inputs[slot];
+
+    // predicted: the last input known in order
+    if (netplay->confirmed_frame == 0) return 0x00;
+
+    return netplay->remote_inputs[(netplay->confirmed_frame - 1) & (NETPLAY_INPUT_RING - 1)];
+}
+
+// simulates 'frame' from the current state, only the
+// newest frame has to be drawn
+static void netplay_simulate(Netplay *netplay, uint32_t frame, uint8_t draw) {
+    uint32_t slot = frame & (NETPLAY_INPUT_RING - 1);
+    uint8_t remote = netplay_remote_input(netplay, frame);
+    uint8_t local_side = netplay->local_side;
+
+    netplay_save(netplay, frame);
+
+    netplay->used_remote_inputs[slot] = remote;
+
+    joypad_set(&netplay->gb[local_side]->joypad, netplay->local_inputs[slot]);
+    joypad_set(&netplay->gb[local_side ^ 1]->joypad, remote);
+
+    ppu_set_render_enable(&netplay->gb[0]->ppu, draw);
+    ppu_set_render_enable(&netplay->gb[1]->ppu, draw);
+
+    link_run_frame(netplay->link);
+}
+
+static void netplay_receive(Netplay *netplay) {
+    NetplayPacket packet;
+
+    while (net_receive(netplay->transport, (uint8_t*)&packet, sizeof(packet)) == sizeof(packet)) {
+        for (uint8_t i = 0; i < MIN(packet.num_inputs, NETPLAY_SNAPSHOTS); i++) {
+            uint32_t frame = packet.first_frame + i;
+            uint32_t slot = frame & (NETPLAY_INPUT_RING - 1);
+
+            // already known, or too old to matter
+            if (frame < netplay->confirmed_frame || netplay->remote_tags[slot] == frame) continue;
+
+            netplay->remote_inputs[slot] = packet.inputs[i];
+            netplay->remote_tags[slot] = frame;
+
+            if (frame < netplay->frame && netplay->used_remote_inputs[slot] != packet.inputs[i])
+                netplay->rollback_frame = MIN(netplay->rollback_frame, frame);
+        }
+
+        while (netplay->remote_tags[netplay->confirmed_frame & (NETPLAY_INPUT_RING - 1)] == netplay->confirmed_frame)
+            netplay->confirmed_frame++;
+    }
+}
+
+static void netplay_rollback(Netplay *netplay) {
+    uint32_t from = netplay->rollback_frame;
+
+    if (from == NO_ROLLBACK) return;
+
+    netplay->rollback_frame = NO_ROLLBACK;
+
+    uint64_t start = get_time_ns();
+
+    netplay_load(netplay, from);
+
+    for (uint32_t f = from; f < netplay->frame; f++) netplay_simulate(netplay, f, f + 1 == netplay->frame);
+
+    netplay->stats.resimulate_ns += get_time_ns() - start;
+    netplay->stats.rollbacks++;
+    netplay->stats.resimulated_frames += netplay->frame - from;
+    netplay->stats.max_rollback = MAX(netplay->stats.max_rollback, netplay->frame - from);
+}
+
+static void netplay_send(Netplay *netplay) {
+    NetplayPacket packet;
+
+    uint32_t last = netplay->frame - 1;
+    uint32_t first = (last >= NETPLAY_MAX_ROLLBACK) ? last - NETPLAY_MAX_ROLLBACK : 0;
+
+    memset(&packet, 0, sizeof(packet));
+    packet.first_frame = first;
+    packet.num_inputs = (uint8_t)(last - first + 1);
+
+    for (uint32_t f = first; f <= last; f++)
+        packet.inputs[f - first] = netplay->local_inputs[f & (NETPLAY_INPUT_RING - 1)];
+
+    net_send(netplay->transport, (const uint8_t*)&packet, sizeof(packet));
+}
+
+// 'local_side' is the GB (0 or 1) controlled by this peer,
+// both GBs have to start in the same state on both peers
+Netplay *create_netplay(GB *a, GB *b, NetTransport *transport, uint8_t local_side) {
+    Netplay *new_netplay = (Netplay*)calloc(1, sizeof(Netplay));
+
+    new_netplay->gb[0] = a;
+    new_netplay->gb[1] = b;
+    new_netplay->link = create_link(a, b);
+    new_netplay->transport = transport;
+    new_netplay->local_side = local_side;
+
+    new_netplay->frame = 0;
+    new_netplay->confirmed_frame = 0;
+    new_netplay->rollback_frame = NO_ROLLBACK;
+
+    for (uint32_t i = 0; i < NETPLAY_INPUT_RING; i++) new_netplay->remote_tags[i] = NO_ROLLBACK;
+
+    new_netplay->snapshot_size = gb_state_size(a) + gb_state_size(b);
+
+    for (uint32_t s = 0; s < NETPLAY_SNAPSHOTS; s++)
+        new_netplay->snapshots[s] = (uint8_t*)malloc(new_netplay->snapshot_size);
+
+    return new_netplay;
+}
+
+void destroy_netplay(Netplay *netplay) {
+    if (netplay == NULL) return;
+
+    for (uint32_t s = 0; s < NETPLAY_SNAPSHOTS; s++) free(netplay->snapshots[s]);
+
+    destroy_link(netplay->link);
+    free(netplay);
+}
+
+// runs the next frame with 'local_input', returns 0 without running
+// it when the remote peer is too far behind
+uint8_t netplay_advance(Netplay *netplay, uint8_t local_input) {
+    netplay_receive(netplay);
+    netplay_rollback(netplay);
+
+    if (netplay->frame >= netplay->confirmed_frame + NETPLAY_MAX_ROLLBACK) {
+        netplay->stats.stalls++;
+        return 0;
+    }
+
+    netplay->local_inputs[netplay->frame & (NETPLAY_INPUT_RING - 1)] = local_input;
+
+    netplay_simulate(netplay, netplay->frame, 1);
+    netplay->frame++;
+    netplay->stats.frames++;
+
+    netplay_send(netplay);
+
+    return 1;
+}
+
+// handles arrived input (and rolls back if needed) without advancing,
+// the latest local inputs are sent again in case they got lost
+void netplay_poll(Netplay *netplay) {
+    netplay_receive(netplay);
+    netplay_rollback(netplay);
+
+    if (netplay->frame > 0) netplay_send(netplay);
+}
@@ -0,0 +1,74 @@
+#ifndef NETPLAY_H
+#define NETPLAY_H
+
+#include <stdint.h>
+
+#include "gb.h"
+#include "link.h"
+#include "net.h"
+
+// Rollback netplay for two linked GBs.
+//
+// Both peers run the same pair of GBs connected with a Link, each
+// controlling one of them. Remote input that hasn't arrived yet is
+// predicted to be the last one received. When the real input turns out
+// different, the pair is restored from the snapshot of that frame and
+// re-simulated up to the present within the same call. A peer stalls
+// instead of getting more than NETPLAY_MAX_ROLLBACK frames ahead of the
+// remote input it has.
+
+#define NETPLAY_MAX_ROLLBACK 8
+#define NETPLAY_SNAPSHOTS    (NETPLAY_MAX_ROLLBACK + 1)
+#define NETPLAY_INPUT_RING   64 // has to be a power of 2
+
+typedef struct NetplayStats {
+    uint32_t frames;
+    uint32_t stalls;
+    uint32_t rollbacks;
+    uint32_t resimulated_frames;
+    uint32_t max_rollback;
+
+    uint64_t save_ns;
+    uint32_t saves;
+    uint64_t load_ns;
+    uint32_t loads;
+    uint64_t resimulate_ns;
+} NetplayStats;
+
+typedef struct Netplay {
+    GB *gb[2];
+    Link *link;
+    NetTransport *transport;
+    uint8_t local_side;
+
+    // the next frame to simulate
+    uint32_t frame;
+
+    // every remote input before this frame is known
+    uint32_t confirmed_frame;
+
+    // inputs by frame, the tags tell which frame a slot holds
+    uint8_t local_inputs[NETPLAY_INPUT_RING];
+    uint8_t remote_inputs[NETPLAY_INPUT_RING];
+    uint32_t remote_tags[NETPLAY_INPUT_RING];
+    uint8_t used_remote_inputs[NETPLAY_INPUT_RING];
+
+    // state of both GBs at the start of a frame, by frame
+    uint8_t *snapshots[NETPLAY_SNAPSHOTS];
+    size_t snapshot_size;
+
+    // oldest frame that was simulated with a wrong prediction
+    uint32_t rollback_frame;
+
+    NetplayStats stats;
+} Netplay;
+
+Netplay *create_netplay(GB *a, GB *b, NetTransport *transport, uint8_t local_side);
+
+void destroy_netplay(Netplay *netplay);
+
+uint8_t netplay_advance(Netplay *netplay, uint8_t local_input);
+
+void netplay_poll(Netplay *netplay);
+
+#endif
@@ -0,0 +1,218 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "netplay.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// cart_netplay - runs rollback netplay between two peers, headless
+//
+// usage: cart_netplay <rom a> <rom b> [frames] [latency ms] [jitter ms]
+//        cart_netplay -u <side> <local socket> <remote socket> <rom a> <rom b> [frames]
+//
+// The first form runs both peers in this process over a loopback with
+// artificial latency and checks that they end up in the same state as
+// a run that knew all inputs in advance. The second one runs a single
+// peer (side 0 or 1) over Unix datagram sockets, start one per side.
+//
+// Inputs are pseudo-random, frames are paced to real time and the
+// save/load and re-simulation speed of rollbacks are reported.
+
+#define NS_PER_FRAME 16742706ULL // 70224 dots at 4.194304 MHz
+
+#define DEFAULT_FRAMES 600
+
+// held for a random number of frames so predictions are right most of the time
+static uint8_t test_input(uint8_t side, uint32_t frame) {
+    uint32_t x = (frame / 12 + 1) * 2654435761u ^ (side + 1) * 0x9E3779B9u;
+
+    x ^= x >> 15;
+    x *= 0x85EBCA6Bu;
+    x ^= x >> 13;
+
+    return (uint8_t)x;
+}
+
+static void wait_until(uint64_t time_ns) {
+    uint64_t now = get_time_ns();
+
+    if (now >= time_ns) return;
+
+    struct timespec ts = { (time_t)((time_ns - now) / 1000000000ULL), (long)((time_ns - now) % 1000000000ULL) };
+    nanosleep(&ts, NULL);
+}
+
+static uint8_t netplay_done(Netplay *netplay, uint32_t frames) {
+    return netplay->frame == frames && netplay->confirmed_frame >= frames && netplay->rollback_frame == UINT32_MAX;
+}
+
+// runs one host frame
+static void netplay_tick(Netplay *netplay, uint32_t frames) {
+    if (netplay->frame < frames) netplay_advance(netplay, test_input(netplay->local_side, netplay->frame));
+    else netplay_poll(netplay);
+}
+
+static void print_stats(Netplay *netplay, const char *name) {
+    NetplayStats *stats = &netplay->stats;
+
+    double save_us = stats->saves ? (double)stats->save_ns / stats->saves / 1e3 : 0.0;
+    double load_us = stats->loads ? (double)stats->load_ns / stats->loads / 1e3 : 0.0;
+    double speed = stats->resimulate_ns ? (double)stats->resimulated_frames * NS_PER_FRAME / (double)stats->resimulate_ns : 0.0;
+
+    printf(
+            "%s: %u frames, %u stalls, %u rollbacks (%u frames re-simulated, max %u), state %016llx\n"
+            "    save %.1f us, load %.1f us, re-simulation %.1fx real time",
+            name,
+            stats->frames,
+            stats->stalls,
+            stats->rollbacks,
+            stats->resimulated_frames,
+            stats->max_rollback,
+            (unsigned long long)(gb_state_hash(netplay->gb[0]) ^ gb_state_hash(netplay->gb[1])),
+            save_us,
+            load_us,
+            speed
+    );
+
+    // the worst case has to fit into a single host frame
+    if (speed > 0.0)
+        printf(", %d frame rollback %.2f ms\n", NETPLAY_MAX_ROLLBACK, NETPLAY_MAX_ROLLBACK * NS_PER_FRAME / speed / 1e6 + load_us / 1e3);
+    else
+        printf("\n");
+}
+
+// the state both peers have to reach
+static uint64_t reference_hash(const char *rom_a, const char *rom_b, uint32_t frames) {
+    GB *gb[2] = { create_gb(rom_a), create_gb(rom_b) };
+    Link *link = create_link(gb[0], gb[1]);
+
+    for (uint32_t f = 0; f < frames; f++) {
+        joypad_set(&gb[0]->joypad, test_input(0, f));
+        joypad_set(&gb[1]->joypad, test_input(1, f));
+
+        link_run_frame(link);
+    }
+
+    uint64_t hash = gb_state_hash(gb[0]) ^ gb_state_hash(gb[1]);
+
+    destroy_link(link);
+    destroy_gb(gb[0]);
+    destroy_gb(gb[1]);
+    return hash;
+}
+
+static int run_loopback(const char *rom_a, const char *rom_b, uint32_t frames, uint32_t latency_ms, uint32_t jitter_ms) {
+    GB *gb[2][2];
+    NetTransport *ends[2];
+    Netplay *netplay[2];
+
+    for (uint8_t p = 0; p < 2; p++) {
+        gb[p][0] = create_gb(rom_a);
+        gb[p][1] = create_gb(rom_b);
+
+        if (gb[p][0] == NULL || gb[p][1] == NULL) return -1;
+    }
+
+    create_loopback_transports(ends);
+
+    for (uint8_t p = 0; p < 2; p++) {
+        net_set_latency(ends[p], latency_ms, jitter_ms);
+        netplay[p] = create_netplay(gb[p][0], gb[p][1], ends[p], p);
+    }
+
+    uint64_t next = get_time_ns();
+
+    while (!netplay_done(netplay[0], frames) || !netplay_done(netplay[1], frames)) {
+        netplay_tick(netplay[0], frames);
+        netplay_tick(netplay[1], frames);
+
+        next += NS_PER_FRAME;
+        wait_until(next);
+    }
+
+    print_stats(netplay[0], "peer 0");
+    print_stats(netplay[1], "peer 1");
+
+    uint64_t hashes[2];
+
+    for (uint8_t p = 0; p < 2; p++) hashes[p] = gb_state_hash(gb[p][0]) ^ gb_state_hash(gb[p][1]);
+
+    uint64_t reference = reference_hash(rom_a, rom_b, frames);
+    uint8_t synchronized = hashes[0] == reference && hashes[1] == reference;
+
+    printf("%s, reference state %016llx\n", synchronized ? "synchronized" : "DESYNCHRONIZED", (unsigned long long)reference);
+
+    for (uint8_t p = 0; p < 2; p++) {
+        destroy_netplay(netplay[p]);
+        destroy_net_transport(ends[p]);
+        destroy_gb(gb[p][0]);
+        destroy_gb(gb[p][1]);
+    }
+
+    return synchronized ? 0 : 1;
+}
+
+static int run_unix(uint8_t side, const char *local_path, const char *remote_path, const char *rom_a, const char *rom_b, uint32_t frames) {
+    GB *a = create_gb(rom_a);
+    GB *b = create_gb(rom_b);
+    NetTransport *transport = create_unix_transport(local_path, remote_path);
+
+    if (a == NULL || b == NULL || transport == NULL) {
+        destroy_net_transport(transport);
+        destroy_gb(a);
+        destroy_gb(b);
+        return -1;
+    }
+
+    Netplay *netplay = create_netplay(a, b, transport, side);
+    uint64_t next = get_time_ns();
+
+    // the other peer still needs our last inputs after we're done,
+    // so keep sending them for a second
+    uint32_t linger = 60;
+
+    while (linger > 0) {
+        netplay_tick(netplay, frames);
+
+        if (netplay_done(netplay, frames)) linger--;
+
+        next += NS_PER_FRAME;
+        wait_until(next);
+    }
+
+    print_stats(netplay, side ? "peer 1" : "peer 0");
+
+    destroy_netplay(netplay);
+    destroy_net_transport(transport);
+    destroy_gb(a);
+    destroy_gb(b);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc >= 7 && strcmp(argv[1], "-u") == 0)
+        return run_unix(
+                (uint8_t)(atoi(argv[2]) & 1),
+                argv[3],
+                argv[4],
+                argv[5],
+                argv[6],
+                (argc >= 8) ? (uint32_t)atoi(argv[7]) : DEFAULT_FRAMES
+        );
+
+    if (argc >= 3 && argv[1][0] != '-')
+        return run_loopback(
+                argv[1],
+                argv[2],
+                (argc >= 4) ? (uint32_t)atoi(argv[3]) : DEFAULT_FRAMES,
+                (argc >= 5) ? (uint32_t)atoi(argv[4]) : 0,
+                (argc >= 6) ? (uint32_t)atoi(argv[5]) : 0
+        );
+
+    fprintf(stderr, "usage: %s <rom a> <rom b> [frames] [latency ms] [jitter ms]\n", argv[0]);
+    fprintf(stderr, "       %s -u <side> <local socket> <remote socket> <rom a> <rom b> [frames]\n", argv[0]);
+    return -1;
+}
@@ -1,26 +1,35 @@
 #include "ppu.h"
 #include "gb.h"
 #include "util.h"
+#include "stats.h"
 
 #include <stdio.h>
+#include <string.h>
 
 extern uint8_t print_debug;
 
+// index of a register in the line log
+#define LINE_REG(reg) ((reg) - LCDC_ADDR_RELATIVE)
+
 static inline void horizontal_rectrace(PPU *ppu) {
     ppu->gb->io[LY_ADDR_RELATIVE] = ++ppu->current_line;
 }
 
 static inline void vertical_retrace(PPU *ppu) {
     ppu->gb->io[LY_ADDR_RELATIVE] = ppu->current_line= 0;
+    ppu->render_frame = ppu->render_enable;
 }
 
 static uint16_t fetch_tile_row_data(PPU *ppu, uint16_t addr, uint8_t idx, uint8_t y) {
     if (addr == 0x8800) idx -= 128;
+
+    STATS_COUNT(ppu->gb->stats, STATS_COUNTER_TILE_FETCHES);
     
     uint16_t row_addr = addr + ((uint16_t)idx * 16) + ((uint16_t)y * 2);
 
-    uint8_t row_lo = mmu_read(&ppu->gb->mmu, row_addr);
-    uint8_t row_hi = mmu_read(&ppu->gb->mmu, row_addr + 1);
+    // the PPU has its own bus to VRAM and OAM
+    uint8_t row_lo = ppu->gb->vram[row_addr - VRAM_BASE_ADDR];
+    uint8_t row_hi = ppu->gb->vram[row_addr - VRAM_BASE_ADDR + 1];
 
     uint16_t row_data = 0x0000;
 
@@ -43,10 +52,27 @@ static inline uint8_t get_color_index(uint16_t row_data, uint8_t tile_x) {
     return (row_data >> ((7 - tile_x) * 2)) & 0x03;
 }
 
+static inline uint8_t apply_palette(uint8_t palette, uint8_t color_idx) {
+    return (palette >> (color_idx * 2)) & 0x03;
+}
+
 static uint8_t fetch_palette_color(PPU *ppu, uint16_t pal_addr, uint8_t color_idx) {
-    uint8_t palette = ppu->gb->io[pal_addr];
+    return apply_palette(ppu->gb->io[pal_addr], color_idx);
+}
 
-    return (palette >> (color_idx * 2)) & 0x03;
+// the object's row on the current line, flipped vertically if needed
+static uint16_t fetch_obj_row(PPU *ppu, uint8_t *obj) {
+    uint8_t obj_y = obj[0] - 16;
+    uint8_t tile_y = (ppu->current_line - obj_y) % 8;
+
+    if (obj[OAM_ATTR_OFFSET] & OAM_ATTR_Y_FLIP_MASK) tile_y = 7 - tile_y;
+
+    uint8_t tile_idx = obj[OAM_TILE_OFFSET];
+
+    if (ppu->current_line - obj_y >= 8)
+        tile_idx++;
+
+    return fetch_tile_row_data(ppu, 0x8000, tile_idx, tile_y);
 }
 
 static inline void draw_pixel(PPU *ppu, uint8_t x, uint8_t y, uint8_t color) {
@@ -64,10 +90,30 @@ void ppu_init(PPU *ppu, struct GB *gb) {
         .current_line = 0,
         .selected_objs = {0,0,0,0,0,0,0,0,0,0},
         .num_objs = 0,
+        .obj_table_dirty = 1,
+        .render_enable = 1,
+        .render_frame = 1,
         .gb = gb
     };
 }
 
+// the next dot anything but the coincidence flag changes at
+static inline uint16_t next_event_dot(PPU *ppu) {
+    uint16_t end;
+
+    switch (ppu->mode) {
+        case PPU_MODE_OAM_SCAN:   end = OAM_SCAN_DOTS; break;
+        case PPU_MODE_PIXEL_DRAW: end = PIXEL_DRAW_DOTS; break;
+        case PPU_MODE_HBLANK:     end = HBLANK_DOTS; break;
+        default:                  end = (ppu->current_dot / DOTS_PER_LINE + 1) * DOTS_PER_LINE; break;
+    }
+
+    if (ppu->current_dot < 1) return 1;
+    if (ppu->current_dot >= end) return ppu->current_dot + 1;
+
+    return end;
+}
+
 void ppu_step(PPU *ppu, uint8_t cycles) {
     // Processing dot by dot should yield the most accurate
     // timing results, but does it really matter in
@@ -76,7 +122,16 @@ void ppu_step(PPU *ppu, uint8_t cycles) {
 
     if ((lcdc & LCDC_LCD_PPU_ENABLE_MASK) == 0) return;
 
-    for (uint8_t d = 0; d <= (cycles * DOTS_PER_CYCLE_DMG); d++) {
+    uint16_t dots = cycles * DOTS_PER_CYCLE_DMG + 1;
+
+    while (dots > 0) {
+        // the dots before the next event would only refresh
+        // the coincidence flag, which the last one does anyway
+        uint16_t skip = MIN(next_event_dot(ppu) - ppu->current_dot, dots) - 1;
+
+        ppu->current_dot += skip;
+        dots -= skip + 1;
+
         ppu->current_dot++;
 
         ppu_update_stat(ppu);
@@ -84,7 +139,7 @@ void ppu_step(PPU *ppu, uint8_t cycles) {
         switch (ppu->mode) {
             case PPU_MODE_OAM_SCAN:
                 if (ppu->current_dot == OAM_SCAN_DOTS) {
-                    ppu_scan_oam(ppu, lcdc);
+                    if (ppu->render_frame) ppu_scan_oam(ppu, lcdc);
                     ppu->mode = PPU_MODE_PIXEL_DRAW;
                     ppu->current_dot = 0;
                 }
@@ -92,7 +147,13 @@ void ppu_step(PPU *ppu, uint8_t cycles) {
 
             case PPU_MODE_PIXEL_DRAW:
                 if (ppu->current_dot == PIXEL_DRAW_DOTS) {
-                    ppu_draw_scanline(ppu, lcdc);
+                    // only lines with registers changing mid-line need the slow path
+                    if (ppu->render_frame) {
+                        if (ppu->num_line_writes == 0) ppu_draw_scanline(ppu, lcdc);
+                        else ppu_draw_scanline_timed(ppu);
+                    }
+
+                    ppu->num_line_writes = 0;
                     ppu->mode = PPU_MODE_HBLANK;
                     ppu->current_dot = 0;
                 }
@@ -112,6 +173,8 @@ void ppu_step(PPU *ppu, uint8_t cycles) {
                 if (ppu->current_dot == 1) {
                     gb_interrupt(ppu->gb, INTERRUPT_VBLANK);
                     ppu->gb->frame_ready = 1;
+
+                    STATS_END_FRAME(ppu->gb->stats);
                 }
 
                 if (ppu->current_dot % DOTS_PER_LINE == 0)
@@ -128,28 +191,104 @@ void ppu_step(PPU *ppu, uint8_t cycles) {
     }
 }
 
+// dots the PPU can run for before anything but the coincidence flag changes
+uint32_t ppu_quiet_dots(PPU *ppu) {
+    if ((ppu->gb->io[LCDC_ADDR_RELATIVE] & LCDC_LCD_PPU_ENABLE_MASK) == 0) return UINT32_MAX;
+
+    return next_event_dot(ppu) - ppu->current_dot - 1;
+}
+
+// runs up to ppu_quiet_dots() at once
+void ppu_skip_dots(PPU *ppu, uint32_t dots) {
+    if ((ppu->gb->io[LCDC_ADDR_RELATIVE] & LCDC_LCD_PPU_ENABLE_MASK) == 0) return;
+
+    ppu->current_dot += dots;
+    ppu_update_stat(ppu);
+}
+
+void ppu_set_render_enable(PPU *ppu, uint8_t enable) {
+    // takes effect from the next frame so that
+    // a frame is never only partially drawn
+    ppu->render_enable = enable;
+}
+
+// every object is added to the lines it covers, up to 10 per line
+static void build_obj_table(PPU *ppu, uint8_t sprite_h) {
+    PPUObjTable *table = &ppu->gb->obj_table;
+
+    STATS_COUNT(ppu->gb->stats, STATS_COUNTER_OBJ_TABLE_BUILDS);
+
+    memset(table->num_objs, 0, sizeof(table->num_objs));
+    table->obj_height = sprite_h;
+
+    for (uint8_t o = 0; o < OBJ_COUNT; o++) {
+        int16_t top = (int16_t)ppu->gb->oam[o * 4] - 16;
+
+        for (int16_t line = MAX(top, 0); line < MIN(top + sprite_h, OBJ_TABLE_LINES); line++)
+            if (table->num_objs[line] < OBJS_PER_LINE)
+                table->objs[line][table->num_objs[line]++] = o;
+    }
+
+    ppu->obj_table_dirty = 0;
+}
+
 void ppu_scan_oam(PPU *ppu, uint8_t lcdc) {
-    ppu->num_objs = 0;
+    PPUObjTable *table = &ppu->gb->obj_table;
 
     uint8_t sprite_h = (lcdc & LCDC_OBJ_SIZE_MASK)
         ? OBJ_HEIGHT_TALL
         : OBJ_HEIGHT_SHORT;
 
-    for (uint8_t o = 0; o < 40; o++) {
-        uint8_t obj_y = mmu_read(&ppu->gb->mmu, OAM_BASE_ADDR + (o * 4));
+    if (ppu->obj_table_dirty || table->obj_height != sprite_h) build_obj_table(ppu, sprite_h);
 
-        if (obj_y > 16 - sprite_h && ppu->current_line + 16 >= obj_y && ppu->current_line + 16 < obj_y + sprite_h)
-            ppu->selected_objs[ppu->num_objs++] = o;
+    ppu->num_objs = table->num_objs[ppu->current_line];
+    memcpy(ppu->selected_objs, table->objs[ppu->current_line], ppu->num_objs);
+}
 
-        if (ppu->num_objs == 10) return;
+// Writes to the registers the renderer samples. During mode 3 they
+// are logged with the dot they happened at so that the line can be
+// drawn with the values changing mid-line (see ppu_draw_scanline_timed()).
+// The dot is the one the writing instruction started at.
+void ppu_write_register(PPU *ppu, uint8_t reg, uint8_t val) {
+    uint8_t *io = ppu->gb->io;
+
+    if (ppu->mode == PPU_MODE_PIXEL_DRAW && ppu->render_frame && io[reg] != val &&
+        (io[LCDC_ADDR_RELATIVE] & LCDC_LCD_PPU_ENABLE_MASK) &&
+        ppu->num_line_writes < PPU_MAX_LINE_WRITES) {
+        PPULineLog *log = &ppu->gb->line_log;
+
+        if (ppu->num_line_writes == 0) memcpy(log->start_regs, &io[LCDC_ADDR_RELATIVE], PPU_REGS);
+
+        log->writes[ppu->num_line_writes++] = (PPULineWrite){
+            .dot = (uint8_t)ppu->current_dot,
+            .reg = LINE_REG(reg),
+            .val = val
+        };
     }
+
+    // the screen is blank while the LCD is off
+    if (reg == LCDC_ADDR_RELATIVE && (io[reg] & LCDC_LCD_PPU_ENABLE_MASK) && (val & LCDC_LCD_PPU_ENABLE_MASK) == 0) {
+        SHARED_BLOCK_WRITE(ppu->gb->framebuffer_block, ppu->gb->framebuffer);
+        memset(ppu->gb->framebuffer, 0, GB_SCREEN_W * GB_SCREEN_H);
+
+        // the line that was cut off isn't drawn from a stale log later
+        ppu->num_line_writes = 0;
+    }
+
+    io[reg] = val;
 }
 
 void ppu_draw_scanline(PPU *ppu, uint8_t lcdc) {
+    // forks share the framebuffer until they draw
+    SHARED_BLOCK_WRITE(ppu->gb->framebuffer_block, ppu->gb->framebuffer);
+
     if (lcdc & LCDC_BG_WIND_ENABLE_MASK) {
         ppu_draw_bg_line(ppu, lcdc);
 
         if (lcdc & LCDC_WIND_ENABLE_MASK) ppu_draw_wind_line(ppu, lcdc);
+    } else {
+        // the background is blank, not left over from the last drawn frame
+        memset(&ppu->gb->framebuffer[ppu->current_line * GB_SCREEN_W], 0, GB_SCREEN_W);
     }
 
     if (lcdc & LCDC_OBJ_ENABLE_MASK) ppu_draw_obj_line(ppu, lcdc);
@@ -179,7 +318,7 @@ void ppu_draw_bg_line(PPU *ppu, uint8_t lcdc) {
         uint8_t map_x = scrolled_x / TILE_SIZE;
         uint8_t tile_x = scrolled_x % TILE_SIZE;
 
-        uint8_t tile_idx = mmu_read(&ppu->gb->mmu, map_addr + (map_y * MAP_SIZE_TILES) + map_x);
+        uint8_t tile_idx = ppu->gb->vram[map_addr - VRAM_BASE_ADDR + (map_y * MAP_SIZE_TILES) + map_x];
 
         // prevents refetching tile data for every pixel
         if (tile_idx != last_tile_idx || screen_x == 0) {
@@ -215,12 +354,15 @@ void ppu_draw_wind_line(PPU *ppu, uint8_t lcdc) {
     for (uint8_t wind_x = 0; wind_x < GB_SCREEN_W; wind_x++) {
         if (wx + wind_x <  7) continue;
 
+        // the window ends at the edge of the screen
+        if (wx + wind_x - 7 >= GB_SCREEN_W) break;
+
         uint8_t screen_x = wx + wind_x - 7;
 
         uint8_t map_x = wind_x / TILE_SIZE;
         uint8_t tile_x = wind_x % TILE_SIZE;
 
-        uint8_t tile_idx = mmu_read(&ppu->gb->mmu, map_addr + (map_y * MAP_SIZE_TILES) + map_x);
+        uint8_t tile_idx = ppu->gb->vram[map_addr - VRAM_BASE_ADDR + (map_y * MAP_SIZE_TILES) + map_x];
 
         // prevents refetching tile data for every pixel
         if (tile_idx != last_tile_idx || wind_x == 0) {
@@ -236,37 +378,27 @@ void ppu_draw_wind_line(PPU *ppu, uint8_t lcdc) {
 
 void ppu_draw_obj_line(PPU *ppu, uint8_t lcdc) {
     for (uint8_t o = 0; o < ppu->num_objs; o++) {
-        uint16_t obj_loc = OAM_BASE_ADDR + (ppu->selected_objs[o] * 4);
+        uint8_t *obj = &ppu->gb->oam[ppu->selected_objs[o] * 4];
 
-        uint8_t obj_x = mmu_read(&ppu->gb->mmu, obj_loc + OAM_X_OFFSET);
+        uint8_t obj_x = obj[OAM_X_OFFSET];
 
         // object beyond the screenspace
         if (obj_x == 0 || obj_x >= 168)
             continue;
 
-        uint8_t obj_attr = mmu_read(&ppu->gb->mmu, obj_loc + OAM_ATTR_OFFSET);
+        uint8_t obj_attr = obj[OAM_ATTR_OFFSET];
 
         // checking the object's attributes
         uint8_t flipped_x = obj_attr & OAM_ATTR_X_FLIP_MASK;
-        uint8_t flipped_y = obj_attr & OAM_ATTR_Y_FLIP_MASK;
         uint8_t low_priority = obj_attr & OAM_ATTR_PRIORITY_MASK;
         uint16_t pal_addr = (obj_attr & OAM_ATTR_PALETTE_MASK) ? OBP1_ADDR_RELATIVE : OBP0_ADDR_RELATIVE;
 
-        uint8_t obj_y = mmu_read(&ppu->gb->mmu, obj_loc) - 16;
-        uint8_t tile_y = (ppu->current_line - obj_y) % 8;
-
-        if (flipped_y) tile_y = 7 - tile_y;
+        uint16_t tile_data = fetch_obj_row(ppu, obj);
 
-        uint8_t tile_idx = mmu_read(&ppu->gb->mmu, obj_loc + OAM_TILE_OFFSET);
-
-        if (ppu->current_line - obj_y >= 8)
-            tile_idx++;
+        for (uint8_t p = 0; p < 8; p++) {
+            if (obj_x + p < 8 || obj_x + p - 8 >= GB_SCREEN_W) continue; // pixel outside the screen
 
-        uint16_t tile_data = fetch_tile_row_data(ppu, 0x8000, tile_idx, tile_y);
 
-        for (uint8_t p = 0; p < 8; p++) {
-            if (obj_x + p < 8) continue; // pixel outside the screen
-            
             uint8_t color_idx = get_color_index(tile_data, (flipped_x) ? 7 - p : p);
 
             if (color_idx == 0) continue; // pixel is transparent
@@ -283,6 +415,110 @@ void ppu_draw_obj_line(PPU *ppu, uint8_t lcdc) {
     }
 }
 
+// Draws the line with the registers logged by ppu_write_register(),
+// replaying the writes pixel by pixel. A write becomes visible
+// PPU_PIXEL_DELAY_DOTS after it happened, which is roughly when the
+// pixel fetched at that time leaves the FIFO. Fetches and their stalls
+// aren't modelled, otherwise the result matches ppu_draw_scanline().
+void ppu_draw_scanline_timed(PPU *ppu) {
+    PPULineLog *log = &ppu->gb->line_log;
+    uint8_t *vram = ppu->gb->vram;
+    uint8_t line = ppu->current_line;
+
+    STATS_COUNT(ppu->gb->stats, STATS_COUNTER_TIMED_LINES);
+
+    // forks share the framebuffer until they draw
+    SHARED_BLOCK_WRITE(ppu->gb->framebuffer_block, ppu->gb->framebuffer);
+
+    uint8_t regs[PPU_REGS];
+    memcpy(regs, log->start_regs, PPU_REGS);
+
+    // objects don't depend on the registers apart from the palettes
+    uint16_t obj_rows[OBJS_PER_LINE];
+
+    for (uint8_t o = 0; o < ppu->num_objs; o++) {
+        uint8_t *obj = &ppu->gb->oam[ppu->selected_objs[o] * 4];
+
+        if (obj[OAM_X_OFFSET] != 0 && obj[OAM_X_OFFSET] < 168) obj_rows[o] = fetch_obj_row(ppu, obj);
+    }
+
+    // prevents refetching tile data for every pixel
+    uint32_t last_tile = UINT32_MAX;
+    uint16_t tile_data = 0;
+
+    uint8_t next_write = 0;
+
+    for (uint8_t screen_x = 0; screen_x < GB_SCREEN_W; screen_x++) {
+        while (next_write < ppu->num_line_writes &&
+               log->writes[next_write].dot <= screen_x + PPU_PIXEL_DELAY_DOTS) {
+            regs[log->writes[next_write].reg] = log->writes[next_write].val;
+            next_write++;
+        }
+
+        uint8_t lcdc = regs[LINE_REG(LCDC_ADDR_RELATIVE)];
+        uint8_t color = 0;
+
+        if (lcdc & LCDC_BG_WIND_ENABLE_MASK) {
+            uint16_t tiles_addr = (lcdc & LCDC_BG_WIND_TILES_MASK) ? 0x8000 : 0x8800;
+            uint8_t wx = regs[LINE_REG(WX_ADDR_RELATIVE)];
+            uint8_t wy = regs[LINE_REG(WY_ADDR_RELATIVE)];
+
+            uint16_t map_addr;
+            uint8_t x, y;
+
+            // same conditions as ppu_draw_wind_line()
+            if ((lcdc & LCDC_WIND_ENABLE_MASK) && line >= wy && wx < GB_SCREEN_W + 7 && wy < GB_SCREEN_H &&
+                screen_x + 7 >= wx && screen_x + 7 - wx < GB_SCREEN_W) {
+                map_addr = (lcdc & LCDC_WIND_TILE_MAP_MASK) ? 0x9C00 : 0x9800;
+                x = screen_x + 7 - wx;
+                y = line - wy;
+            } else {
+                map_addr = (lcdc & LCDC_BG_TILE_MAP_MASK) ? 0x9C00 : 0x9800;
+                x = screen_x + regs[LINE_REG(SCX_ADDR_RELATIVE)];
+                y = line + regs[LINE_REG(SCY_ADDR_RELATIVE)];
+            }
+
+            uint8_t tile_idx = vram[map_addr - VRAM_BASE_ADDR + ((y / TILE_SIZE) * MAP_SIZE_TILES) + x / TILE_SIZE];
+            uint32_t tile = ((uint32_t)tiles_addr << 16) | ((uint32_t)tile_idx << 8) | (y % TILE_SIZE);
+
+            if (tile != last_tile) {
+                last_tile = tile;
+                tile_data = fetch_tile_row_data(ppu, tiles_addr, tile_idx, y % TILE_SIZE);
+            }
+
+            color = apply_palette(regs[LINE_REG(BGP_ADDR_RELATIVE)], get_color_index(tile_data, x % TILE_SIZE));
+        }
+
+        // objects are drawn over each other in the same order as in ppu_draw_obj_line()
+        for (uint8_t o = 0; o < ppu->num_objs && (lcdc & LCDC_OBJ_ENABLE_MASK); o++) {
+            uint8_t *obj = &ppu->gb->oam[ppu->selected_objs[o] * 4];
+
+            uint8_t obj_x = obj[OAM_X_OFFSET];
+
+            if (obj_x == 0 || obj_x >= 168 || screen_x + 8 < obj_x || screen_x >= obj_x)
+                continue;
+
+            uint8_t obj_attr = obj[OAM_ATTR_OFFSET];
+            uint8_t p = screen_x + 8 - obj_x;
+
+            uint8_t color_idx = get_color_index(obj_rows[o], (obj_attr & OAM_ATTR_X_FLIP_MASK) ? 7 - p : p);
+
+            if (color_idx == 0) continue; // pixel is transparent
+
+            if ((obj_attr & OAM_ATTR_PRIORITY_MASK) && apply_palette(regs[LINE_REG(BGP_ADDR_RELATIVE)], 0) != color)
+                continue; // object has low priority
+
+            uint8_t palette = (obj_attr & OAM_ATTR_PALETTE_MASK)
+                ? regs[LINE_REG(OBP1_ADDR_RELATIVE)]
+                : regs[LINE_REG(OBP0_ADDR_RELATIVE)];
+
+            color = apply_palette(palette, color_idx);
+        }
+
+        draw_pixel(ppu, screen_x, line, color);
+    }
+}
+
 void ppu_update_stat(PPU *ppu) {
     uint8_t stat = ppu->gb->io[STAT_ADDR_RELATIVE];
 
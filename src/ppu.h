@@ -76,6 +76,19 @@
 #define MAP_SIZE_TILES 32
 #define MAP_SIZE_PIXELS 256
 
+#define OBJS_PER_LINE   10
+#define OBJ_TABLE_LINES 144
+#define OBJ_COUNT       40
+
+// LCDC to WX, the registers the renderer samples
+#define PPU_REGS 12
+
+// a write takes at least 2 M-cycles, so no more fit in mode 3
+#define PPU_MAX_LINE_WRITES 24
+
+// dots from the start of mode 3 until the first pixel is pushed out
+#define PPU_PIXEL_DELAY_DOTS 12
+
 typedef enum PPUMode {
     PPU_MODE_HBLANK     = 0,
     PPU_MODE_VBLANK     = 1,
@@ -83,15 +96,51 @@ typedef enum PPUMode {
     PPU_MODE_PIXEL_DRAW = 3
 } PPUMode;
 
+// the objects selected on every visible line, in OAM order; it only
+// has to be rebuilt when OAM or the object size changes
+typedef struct PPUObjTable {
+    uint8_t objs[OBJ_TABLE_LINES][OBJS_PER_LINE];
+    uint8_t num_objs[OBJ_TABLE_LINES];
+
+    // the object height the table was built for
+    uint8_t obj_height;
+} PPUObjTable;
+
+typedef struct PPULineWrite {
+    uint8_t dot; // into mode 3
+    uint8_t reg; // relative to LCDC
+    uint8_t val;
+} PPULineWrite;
+
+// register writes during mode 3 of the current line, see ppu_draw_scanline_timed()
+typedef struct PPULineLog {
+    // the registers before the first write
+    uint8_t start_regs[PPU_REGS];
+    PPULineWrite writes[PPU_MAX_LINE_WRITES];
+} PPULineLog;
+
 typedef struct PPU {
     PPUMode mode;
 
     uint16_t current_dot;
     uint8_t current_line;
 
-    uint8_t selected_objs[10];
+    uint8_t selected_objs[OBJS_PER_LINE];
     uint8_t num_objs;
 
+    // set on every OAM write, the table lives in the GB (see ppu_scan_oam())
+    uint8_t obj_table_dirty;
+
+    // entries in the GB's line log, the line is drawn with the fast
+    // scanline renderer while there are none
+    uint8_t num_line_writes;
+
+    // when render_frame is 0 the PPU keeps its timing (modes, LY,
+    // STAT, interrupts) but skips the OAM scan and rasterization;
+    // it's latched from render_enable at the start of every frame
+    uint8_t render_enable;
+    uint8_t render_frame;
+
     struct GB *gb;
 } PPU;
 
@@ -99,10 +148,20 @@ void ppu_init(PPU *ppu, struct GB *gb);
 
 void ppu_step(PPU *ppu, uint8_t cycles);
 
+uint32_t ppu_quiet_dots(PPU *ppu);
+
+void ppu_skip_dots(PPU *ppu, uint32_t dots);
+
+void ppu_set_render_enable(PPU *ppu, uint8_t enable);
+
 void ppu_scan_oam(PPU *ppu, uint8_t lcdc);
 
+void ppu_write_register(PPU *ppu, uint8_t reg, uint8_t val);
+
 void ppu_draw_scanline(PPU *ppu, uint8_t lcdc);
 
+void ppu_draw_scanline_timed(PPU *ppu);
+
 void ppu_draw_bg_line(PPU *ppu, uint8_t lcdc);
 
 void ppu_draw_wind_line(PPU *ppu, uint8_t lcdc);
@@ -0,0 +1,232 @@
+#include "profiler.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "gb.h"
+
+static uint32_t get_key(GB *gb, uint16_t pc) {
+    return ((uint32_t)gb_code_bank(gb, pc) << 16) | pc;
+}
+
+static ProfilerEntry *get_entry(Profiler *profiler, uint32_t key) {
+    uint32_t page = key / PROFILER_PAGE_SIZE;
+
+    if (profiler->pages[page] == NULL)
+        profiler->pages[page] = (ProfilerEntry*)calloc(PROFILER_PAGE_SIZE, sizeof(ProfilerEntry));
+
+    return &profiler->pages[page][key % PROFILER_PAGE_SIZE];
+}
+
+static uint32_t add_node(Profiler *profiler, uint32_t key, uint32_t parent) {
+    if (profiler->num_nodes == profiler->max_nodes) {
+        profiler->max_nodes *= 2;
+        profiler->nodes = (ProfilerNode*)realloc(profiler->nodes, profiler->max_nodes * sizeof(ProfilerNode));
+    }
+
+    uint32_t idx = profiler->num_nodes++;
+
+    profiler->nodes[idx] = (ProfilerNode){
+        .key = key,
+        .parent = parent,
+        .first_child = 0,
+        .next_sibling = 0,
+        .cycles = 0
+    };
+
+    if (idx != parent) {
+        profiler->nodes[idx].next_sibling = profiler->nodes[parent].first_child;
+        profiler->nodes[parent].first_child = idx;
+    }
+
+    return idx;
+}
+
+static void enter_call(Profiler *profiler, uint32_t key) {
+    if (profiler->depth == PROFILER_MAX_DEPTH) {
+        profiler->overflow_depth++;
+        return;
+    }
+
+    uint32_t child = profiler->nodes[profiler->current_node].first_child;
+
+    // node 0 is the root, so 0 also means 'no child'
+    while (child != 0 && profiler->nodes[child].key != key)
+        child = profiler->nodes[child].next_sibling;
+
+    if (child == 0) child = add_node(profiler, key, profiler->current_node);
+
+    profiler->current_node = child;
+    profiler->depth++;
+}
+
+static void leave_call(Profiler *profiler) {
+    if (profiler->overflow_depth > 0) {
+        profiler->overflow_depth--;
+        return;
+    }
+
+    if (profiler->depth == 0) return;
+
+    profiler->current_node = profiler->nodes[profiler->current_node].parent;
+    profiler->depth--;
+}
+
+static void write_key(FILE *file, uint32_t key) {
+    if ((key >> 16) == GB_BOOT_BANK)
+        fprintf(file, "boot:%04X", key & 0xFFFF);
+    else
+        fprintf(file, "%03X:%04X", key >> 16, key & 0xFFFF);
+}
+
+static void write_stack(Profiler *profiler, FILE *file, uint32_t node) {
+    if (node == 0) return;
+
+    write_stack(profiler, file, profiler->nodes[node].parent);
+
+    if (profiler->nodes[node].parent != 0) fputc(';', file);
+    write_key(file, profiler->nodes[node].key);
+}
+
+typedef struct ReportLine {
+    uint32_t key;
+    ProfilerEntry entry;
+} ReportLine;
+
+static int compare_report_lines(const void *a, const void *b) {
+    uint64_t x = ((const ReportLine*)a)->entry.cycles;
+    uint64_t y = ((const ReportLine*)b)->entry.cycles;
+
+    return (x < y) - (x > y);
+}
+
+Profiler *create_profiler() {
+    Profiler *new_profiler = (Profiler*)calloc(1, sizeof(Profiler));
+
+    new_profiler->max_nodes = 1024;
+    new_profiler->nodes = (ProfilerNode*)malloc(new_profiler->max_nodes * sizeof(ProfilerNode));
+
+    // root of the call tree, everything outside of known calls goes here
+    add_node(new_profiler, 0, 0);
+
+    return new_profiler;
+}
+
+void destroy_profiler(Profiler *profiler) {
+    if (profiler == NULL) return;
+
+    for (uint32_t p = 0; p < PROFILER_MAX_PAGES; p++) free(profiler->pages[p]);
+
+    free(profiler->nodes);
+    free(profiler);
+}
+
+void profiler_instruction(Profiler *profiler, GB *gb, uint16_t pc, uint8_t opcode, uint8_t cycles) {
+    ProfilerEntry *entry = get_entry(profiler, get_key(gb, pc));
+
+    entry->instructions++;
+    entry->cycles += cycles;
+
+    profiler->nodes[profiler->current_node].cycles += cycles;
+
+    uint16_t new_pc = gb->cpu.pc;
+
+    switch (opcode) {
+        case 0xCD: // call a16
+            enter_call(profiler, get_key(gb, new_pc)); break;
+
+        case 0xC4: // call cc, a16
+        case 0xCC:
+        case 0xD4:
+        case 0xDC:
+            if (new_pc != (uint16_t)(pc + 3)) enter_call(profiler, get_key(gb, new_pc));
+            break;
+
+        case 0xC7: // rst vec
+        case 0xCF:
+        case 0xD7:
+        case 0xDF:
+        case 0xE7:
+        case 0xEF:
+        case 0xF7:
+        case 0xFF:
+            enter_call(profiler, get_key(gb, new_pc)); break;
+
+        case 0xC9: // ret, reti
+        case 0xD9:
+            leave_call(profiler); break;
+
+        case 0xC0: // ret cc
+        case 0xC8:
+        case 0xD0:
+        case 0xD8:
+            if (new_pc != (uint16_t)(pc + 1)) leave_call(profiler);
+            break;
+    }
+}
+
+void profiler_interrupt(Profiler *profiler, GB *gb, uint16_t vector, uint8_t cycles) {
+    profiler->nodes[profiler->current_node].cycles += cycles;
+
+    enter_call(profiler, get_key(gb, vector));
+}
+
+void profiler_write_report(Profiler *profiler, FILE *file, uint32_t max_entries) {
+    uint32_t num_lines = 0;
+    uint32_t max_lines = 1024;
+    ReportLine *lines = (ReportLine*)malloc(max_lines * sizeof(ReportLine));
+
+    uint64_t total_cycles = 0;
+    uint64_t total_instructions = 0;
+
+    for (uint32_t p = 0; p < PROFILER_MAX_PAGES; p++) {
+        if (profiler->pages[p] == NULL) continue;
+
+        for (uint32_t e = 0; e < PROFILER_PAGE_SIZE; e++) {
+            ProfilerEntry entry = profiler->pages[p][e];
+
+            if (entry.instructions == 0) continue;
+
+            if (num_lines == max_lines) {
+                max_lines *= 2;
+                lines = (ReportLine*)realloc(lines, max_lines * sizeof(ReportLine));
+            }
+
+            lines[num_lines++] = (ReportLine){ p * PROFILER_PAGE_SIZE + e, entry };
+
+            total_cycles += entry.cycles;
+            total_instructions += entry.instructions;
+        }
+    }
+
+    qsort(lines, num_lines, sizeof(ReportLine), compare_report_lines);
+
+    fprintf(file, "total: %llu instructions, %llu cycles\n\n",
+            (unsigned long long)total_instructions, (unsigned long long)total_cycles);
+    fprintf(file, "bank:pc      instructions           cycles       %%\n");
+
+    for (uint32_t l = 0; l < num_lines && l < max_entries; l++) {
+        write_key(file, lines[l].key);
+        fprintf(
+                file,
+                " %16llu %16llu %6.2f\n",
+                (unsigned long long)lines[l].entry.instructions,
+                (unsigned long long)lines[l].entry.cycles,
+                100.0 * (double)lines[l].entry.cycles / (double)total_cycles
+        );
+    }
+
+    free(lines);
+}
+
+void profiler_write_folded(Profiler *profiler, FILE *file) {
+    // one line per call stack: "frame;frame;frame cycles"
+    for (uint32_t n = 0; n < profiler->num_nodes; n++) {
+        if (profiler->nodes[n].cycles == 0) continue;
+
+        if (n == 0) fprintf(file, "root");
+        else write_stack(profiler, file, n);
+
+        fprintf(file, " %llu\n", (unsigned long long)profiler->nodes[n].cycles);
+    }
+}
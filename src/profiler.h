@@ -0,0 +1,72 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "gb.h"
+
+// Guest code profiler, only compiled in with CART_PROFILER defined.
+//
+// Instructions and cycles are counted per (ROM bank, PC) and a call
+// tree is built from CALL/RST/RET/RETI and interrupt entries, so hot
+// spots can be reported both flat and as flame-graph folded stacks.
+
+#define PROFILER_PAGE_SIZE 0x4000
+#define PROFILER_MAX_PAGES ((GB_BOOT_BANK + 1) * 4)
+
+// deeper calls are attributed to the deepest frame, games that
+// never return from their calls would grow the tree forever otherwise
+#define PROFILER_MAX_DEPTH 256
+
+typedef struct ProfilerEntry {
+    uint64_t instructions;
+    uint64_t cycles;
+} ProfilerEntry;
+
+typedef struct ProfilerNode {
+    uint32_t key;
+    uint32_t parent;
+    uint32_t first_child;
+    uint32_t next_sibling;
+    uint64_t cycles;
+} ProfilerNode;
+
+typedef struct Profiler {
+    // entries indexed by (bank << 16 | pc), allocated a page at a time
+    ProfilerEntry *pages[PROFILER_MAX_PAGES];
+
+    ProfilerNode *nodes;
+    uint32_t num_nodes;
+    uint32_t max_nodes;
+
+    uint32_t current_node;
+    uint16_t depth;
+
+    // calls past PROFILER_MAX_DEPTH, their returns mustn't pop tracked ones
+    uint32_t overflow_depth;
+} Profiler;
+
+Profiler *create_profiler();
+
+void destroy_profiler(Profiler *profiler);
+
+void profiler_instruction(Profiler *profiler, struct GB *gb, uint16_t pc, uint8_t opcode, uint8_t cycles);
+
+void profiler_interrupt(Profiler *profiler, struct GB *gb, uint16_t vector, uint8_t cycles);
+
+void profiler_write_report(Profiler *profiler, FILE *file, uint32_t max_entries);
+
+void profiler_write_folded(Profiler *profiler, FILE *file);
+
+#ifdef CART_PROFILER
+#define PROFILER_INSTRUCTION(gb, pc, opcode, cycles) \
+    do { if ((gb)->profiler != NULL) profiler_instruction((gb)->profiler, (gb), (pc), (opcode), (cycles)); } while (0)
+#define PROFILER_INTERRUPT(gb, vector, cycles) \
+    do { if ((gb)->profiler != NULL) profiler_interrupt((gb)->profiler, (gb), (vector), (cycles)); } while (0)
+#else
+#define PROFILER_INSTRUCTION(gb, pc, opcode, cycles) ((void)(pc))
+#define PROFILER_INTERRUPT(gb, vector, cycles) ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,494 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "gb.h"
+#include "hash.h"
+#include "movie.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+// cart_regress - runs a corpus of ROMs headless and in parallel, comparing
+// framebuffer hashes against the ones recorded in a manifest
+//
+// usage: cart_regress run <manifest> [-s] [-j threads] [-o output dir] [-g golden dir]
+//        cart_regress record <manifest> [-s] [-j threads] [-g golden dir] > new manifest
+//
+// Every manifest line is a ROM, a movie ('-' for no input) and the frames
+// to check, optionally with their expected hash. Paths are relative to the
+// manifest and '#' starts a comment:
+//
+//     tests/cpu_instrs.gb  -                 3000:5f1d0c2a9e8b7d64
+//     games/tetris.gb      movies/tetris.cmv 600:0123456789abcdef 1200
+//
+// A frame number N is checked after N gb_run_frame() calls. On a mismatch
+// the actual frame is written as a PNG, and if a golden frame (written by
+// 'record' with -g) exists, a diff image with the differing pixels in red.
+//
+// With -s, ROMs without a movie skip the boot ROM (see gb_skip_boot()),
+// so their frames count from 0x0100 and the hashes have to be recorded
+// with -s as well. Movies start from their own saved state either way.
+
+#define MAX_CHECKS 64
+#define MAX_PATH_LEN 1024
+
+#define NS_PER_FRAME 16742706ULL // 70224 dots at 4.194304 MHz
+
+typedef enum EntryResult {
+    ENTRY_PASS,
+    ENTRY_FAIL,
+    ENTRY_ERROR
+} EntryResult;
+
+typedef struct Check {
+    uint32_t frame;
+    uint8_t has_expected;
+    uint64_t expected;
+    uint64_t actual;
+} Check;
+
+typedef struct Entry {
+    // as written in the manifest
+    char rom_file[MAX_PATH_LEN];
+    char movie_file[MAX_PATH_LEN]; // empty without a movie
+    Check checks[MAX_CHECKS];
+    uint8_t num_checks;
+
+    EntryResult result;
+    uint32_t frames_run;
+    uint64_t time_ns;
+} Entry;
+
+typedef struct Runner {
+    Entry *entries;
+    uint32_t num_entries;
+
+    pthread_mutex_t lock;
+    uint32_t next_entry;
+
+    char manifest_dir[MAX_PATH_LEN];
+
+    uint8_t record;
+    uint8_t skip_boot;
+    const char *output_dir;
+    const char *golden_dir;
+} Runner;
+
+static const uint8_t SHADES[4] = { 0xFF, 0xAA, 0x55, 0x00 };
+
+static uint32_t crc_table[256];
+
+static void init_crc_table(void) {
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+
+        for (uint8_t k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+
+        crc_table[n] = c;
+    }
+}
+
+static uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t len) {
+    for (size_t i = 0; i < len; i++) crc = crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
+
+static void put_be32(uint8_t *dest, uint32_t val) {
+    dest[0] = val >> 24;
+    dest[1] = val >> 16;
+    dest[2] = val >> 8;
+    dest[3] = val;
+}
+
+static void write_png_chunk(FILE *file, const char *type, const uint8_t *data, uint32_t len) {
+    uint8_t buf[4];
+
+    put_be32(buf, len);
+    fwrite(buf, 1, 4, file);
+    fwrite(type, 1, 4, file);
+    fwrite(data, 1, len, file);
+
+    uint32_t crc = crc32_update(0xFFFFFFFF, (const uint8_t*)type, 4);
+    put_be32(buf, crc32_update(crc, data, len) ^ 0xFFFFFFFF);
+    fwrite(buf, 1, 4, file);
+}
+
+// 8-bit RGB PNG, the image data is stored uncompressed (one
+// deflate block per row), which every decoder understands
+static uint8_t write_png(const char *filename, const uint8_t *rgb, uint32_t w, uint32_t h) {
+    FILE *file = fopen(filename, "wb");
+
+    if (file == NULL) {
+        fprintf(stderr, "write_png(): Failed to open file: %s\n", filename);
+        return 0;
+    }
+
+    static const uint8_t SIGNATURE[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    fwrite(SIGNATURE, 1, 8, file);
+
+    uint8_t ihdr[13] = { 0 };
+    put_be32(ihdr, w);
+    put_be32(ihdr + 4, h);
+    ihdr[8] = 8; // bit depth
+    ihdr[9] = 2; // color type RGB
+    write_png_chunk(file, "IHDR", ihdr, sizeof(ihdr));
+
+    uint32_t row_len = 1 + w * 3;
+    uint32_t idat_len = 2 + h * (5 + row_len) + 4;
+    uint8_t *idat = (uint8_t*)malloc(idat_len);
+    uint8_t *p = idat;
+
+    *p++ = 0x78; // zlib header, no compression
+    *p++ = 0x01;
+
+    uint32_t adler_a = 1, adler_b = 0;
+
+    for (uint32_t y = 0; y < h; y++) {
+        *p++ = (y == h - 1) ? 1 : 0; // final block flag
+        *p++ = row_len & 0xFF;
+        *p++ = row_len >> 8;
+        *p++ = ~row_len & 0xFF;
+        *p++ = (~row_len >> 8) & 0xFF;
+
+        uint8_t *row = p;
+
+        *p++ = 0; // no filter
+        memcpy(p, rgb + y * w * 3, w * 3);
+        p += w * 3;
+
+        for (uint32_t i = 0; i < row_len; i++) {
+            adler_a = (adler_a + row[i]) % 65521;
+            adler_b = (adler_b + adler_a) % 65521;
+        }
+    }
+
+    put_be32(p, (adler_b << 16) | adler_a);
+
+    write_png_chunk(file, "IDAT", idat, idat_len);
+    write_png_chunk(file, "IEND", NULL, 0);
+
+    free(idat);
+    fclose(file);
+    return 1;
+}
+
+static const char *base_name(const char *path) {
+    const char *slash = strrchr(path, '/');
+    return (slash != NULL) ? slash + 1 : path;
+}
+
+// 'len' is what snprintf() returned for 'path', over-long paths are rejected
+static uint8_t path_fits(int len, const char *path) {
+    if (len >= 0 && len < MAX_PATH_LEN) return 1;
+
+    fprintf(stderr, "path_fits(): Path is too long: %s...\n", path);
+    return 0;
+}
+
+static uint8_t golden_path(char *dest, const char *golden_dir, Entry *entry, uint32_t frame) {
+    int len = snprintf(dest, MAX_PATH_LEN, "%s/%s-%u.raw", golden_dir, base_name(entry->rom_file), frame);
+    return path_fits(len, dest);
+}
+
+static void write_mismatch_images(Runner *runner, Entry *entry, Check *check, const uint8_t *framebuffer) {
+    uint8_t rgb[GB_SCREEN_W * GB_SCREEN_H * 3];
+    char path[MAX_PATH_LEN];
+
+    for (uint32_t i = 0; i < GB_SCREEN_W * GB_SCREEN_H; i++)
+        memset(&rgb[i * 3], SHADES[framebuffer[i] & 0x03], 3);
+
+    int len = snprintf(path, sizeof(path), "%s/%s-%u.png", runner->output_dir, base_name(entry->rom_file), check->frame);
+
+    if (path_fits(len, path)) write_png(path, rgb, GB_SCREEN_W, GB_SCREEN_H);
+
+    if (runner->golden_dir == NULL || golden_path(path, runner->golden_dir, entry, check->frame) == 0) return;
+
+    FILE *file = fopen(path, "rb");
+    uint8_t golden[GB_SCREEN_W * GB_SCREEN_H];
+
+    if (file == NULL) return;
+
+    size_t read = fread(golden, 1, sizeof(golden), file);
+    fclose(file);
+
+    if (read != sizeof(golden)) return;
+
+    // matching pixels are dimmed, differing ones are red
+    for (uint32_t i = 0; i < GB_SCREEN_W * GB_SCREEN_H; i++) {
+        if (golden[i] == framebuffer[i]) {
+            memset(&rgb[i * 3], 0x80 + SHADES[framebuffer[i] & 0x03] / 4, 3);
+        } else {
+            rgb[i * 3] = 0xFF;
+            rgb[i * 3 + 1] = 0x00;
+            rgb[i * 3 + 2] = 0x00;
+        }
+    }
+
+    len = snprintf(path, sizeof(path), "%s/%s-%u-diff.png", runner->output_dir, base_name(entry->rom_file), check->frame);
+
+    if (path_fits(len, path)) write_png(path, rgb, GB_SCREEN_W, GB_SCREEN_H);
+}
+
+static uint8_t resolve_path(char *dest, const char *dir, const char *path) {
+    int len = (path[0] == '/' || dir[0] == '\0')
+        ? snprintf(dest, MAX_PATH_LEN, "%s", path)
+        : snprintf(dest, MAX_PATH_LEN, "%s/%s", dir, path);
+
+    return path_fits(len, dest);
+}
+
+static void run_entry(Runner *runner, Entry *entry) {
+    char path[MAX_PATH_LEN];
+
+    entry->result = ENTRY_ERROR;
+
+    if (resolve_path(path, runner->manifest_dir, entry->rom_file) == 0) return;
+
+    GB *gb = create_gb(path);
+    Movie *movie = NULL;
+
+    if (gb == NULL) return;
+
+    if (entry->movie_file[0] != '\0') {
+        if (resolve_path(path, runner->manifest_dir, entry->movie_file))
+            movie = create_movie_from_file(path);
+
+        // movie_play() does these checks as well, but here the
+        // inputs are replayed frame by frame
+        if (movie == NULL || movie->state_size != gb_state_size(gb) ||
+            movie->rom_hash != hash64(gb->cartridge->rom, gb->cartridge->rom_size, 0) ||
+            gb_load_state(gb, movie->start_state) == 0) {
+            fprintf(stderr, "run_entry(): Movie doesn't match the ROM: %s\n", entry->movie_file);
+            destroy_movie(movie);
+            destroy_gb(gb);
+            return;
+        }
+    } else if (runner->skip_boot) {
+        gb_skip_boot(gb);
+    }
+
+    uint64_t start = get_time_ns();
+    uint32_t frame = 0;
+
+    entry->result = ENTRY_PASS;
+
+    for (uint8_t c = 0; c < entry->num_checks; c++) {
+        Check *check = &entry->checks[c];
+
+        while (frame < check->frame) {
+            // only checked frames have to be drawn
+            ppu_set_render_enable(&gb->ppu, frame + 1 == check->frame);
+
+            if (movie != NULL && movie->num_frames > 0)
+                joypad_set(&gb->joypad, movie->inputs[MIN(frame, movie->num_frames - 1)]);
+
+            gb_run_frame(gb);
+            frame++;
+        }
+
+        check->actual = hash64(gb->framebuffer, GB_SCREEN_W * GB_SCREEN_H, 0);
+
+        if (runner->record && runner->golden_dir != NULL && golden_path(path, runner->golden_dir, entry, check->frame))
+            write_bytes_to_file(path, gb->framebuffer, GB_SCREEN_W * GB_SCREEN_H);
+
+        if (runner->record || !check->has_expected || check->actual == check->expected) continue;
+
+        entry->result = ENTRY_FAIL;
+        write_mismatch_images(runner, entry, check, gb->framebuffer);
+    }
+
+    entry->frames_run = frame;
+    entry->time_ns = get_time_ns() - start;
+
+    destroy_movie(movie);
+    destroy_gb(gb);
+}
+
+static void *worker(void *data) {
+    Runner *runner = (Runner*)data;
+
+    for (;;) {
+        pthread_mutex_lock(&runner->lock);
+        uint32_t idx = runner->next_entry++;
+        pthread_mutex_unlock(&runner->lock);
+
+        if (idx >= runner->num_entries) break;
+
+        run_entry(runner, &runner->entries[idx]);
+    }
+
+    return NULL;
+}
+
+static int compare_checks(const void *a, const void *b) {
+    uint32_t fa = ((const Check*)a)->frame, fb = ((const Check*)b)->frame;
+    return (fa > fb) - (fa < fb);
+}
+
+static Entry *read_manifest(const char *manifest_file, char *dir, uint32_t *num_entries) {
+    FILE *file = fopen(manifest_file, "r");
+
+    if (file == NULL) {
+        fprintf(stderr, "read_manifest(): Failed to open file: %s\n", manifest_file);
+        return NULL;
+    }
+
+    snprintf(dir, MAX_PATH_LEN, "%s", manifest_file);
+
+    char *slash = strrchr(dir, '/');
+    if (slash != NULL) *slash = '\0';
+    else dir[0] = '\0';
+
+    uint32_t capacity = 64;
+    Entry *entries = (Entry*)malloc(capacity * sizeof(Entry));
+    *num_entries = 0;
+
+    char line[4096];
+    uint32_t line_num = 0;
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+        line_num++;
+
+        char *comment = strchr(line, '#');
+        if (comment != NULL) *comment = '\0';
+
+        char *rom = strtok(line, " \t\r\n");
+        if (rom == NULL) continue;
+
+        char *movie = strtok(NULL, " \t\r\n");
+
+        if (movie == NULL) {
+            fprintf(stderr, "read_manifest(): Missing movie on line %u.\n", line_num);
+            continue;
+        }
+
+        if (*num_entries == capacity) {
+            capacity *= 2;
+            entries = (Entry*)realloc(entries, capacity * sizeof(Entry));
+        }
+
+        Entry *entry = &entries[*num_entries];
+        memset(entry, 0, sizeof(Entry));
+
+        snprintf(entry->rom_file, MAX_PATH_LEN, "%s", rom);
+        if (strcmp(movie, "-") != 0) snprintf(entry->movie_file, MAX_PATH_LEN, "%s", movie);
+
+        char *token;
+
+        while ((token = strtok(NULL, " \t\r\n")) != NULL && entry->num_checks < MAX_CHECKS) {
+            Check *check = &entry->checks[entry->num_checks++];
+            char *hash = strchr(token, ':');
+
+            check->frame = (uint32_t)strtoul(token, NULL, 10);
+            check->has_expected = hash != NULL;
+            if (hash != NULL) check->expected = strtoull(hash + 1, NULL, 16);
+        }
+
+        qsort(entry->checks, entry->num_checks, sizeof(Check), compare_checks);
+
+        (*num_entries)++;
+    }
+
+    fclose(file);
+    return entries;
+}
+
+static void print_entry(Entry *entry) {
+    printf("%s %s", entry->rom_file, (entry->movie_file[0] != '\0') ? entry->movie_file : "-");
+
+    for (uint8_t c = 0; c < entry->num_checks; c++)
+        printf(" %u:%016llx", entry->checks[c].frame, (unsigned long long)entry->checks[c].actual);
+
+    printf("\n");
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3 || (strcmp(argv[1], "run") != 0 && strcmp(argv[1], "record") != 0)) {
+        fprintf(stderr, "usage: %s run <manifest> [-s] [-j threads] [-o output dir] [-g golden dir]\n", argv[0]);
+        fprintf(stderr, "       %s record <manifest> [-s] [-j threads] [-g golden dir] > new manifest\n", argv[0]);
+        return -1;
+    }
+
+    Runner runner = {
+        .record = strcmp(argv[1], "record") == 0,
+        .skip_boot = 0,
+        .output_dir = ".",
+        .golden_dir = NULL
+    };
+
+    long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    for (int a = 3; a < argc; a++) {
+        if (strcmp(argv[a], "-s") == 0) runner.skip_boot = 1;
+        else if (a + 1 == argc) break;
+        else if (strcmp(argv[a], "-j") == 0) num_threads = atol(argv[++a]);
+        else if (strcmp(argv[a], "-o") == 0) runner.output_dir = argv[++a];
+        else if (strcmp(argv[a], "-g") == 0) runner.golden_dir = argv[++a];
+    }
+
+    runner.entries = read_manifest(argv[2], runner.manifest_dir, &runner.num_entries);
+
+    if (runner.entries == NULL) return -1;
+
+    num_threads = MAX(MIN(num_threads, (long)runner.num_entries), 1);
+
+    init_crc_table();
+    pthread_mutex_init(&runner.lock, NULL);
+
+    pthread_t *threads = (pthread_t*)malloc(num_threads * sizeof(pthread_t));
+    uint64_t start = get_time_ns();
+
+    for (long t = 0; t < num_threads; t++) pthread_create(&threads[t], NULL, worker, &runner);
+    for (long t = 0; t < num_threads; t++) pthread_join(threads[t], NULL);
+
+    uint64_t elapsed = MAX(get_time_ns() - start, 1);
+
+    uint32_t passed = 0, failed = 0, errors = 0;
+    uint64_t frames = 0;
+
+    for (uint32_t e = 0; e < runner.num_entries; e++) {
+        Entry *entry = &runner.entries[e];
+
+        frames += entry->frames_run;
+
+        if (runner.record) {
+            if (entry->result != ENTRY_ERROR) print_entry(entry);
+        } else if (entry->result == ENTRY_FAIL) {
+            for (uint8_t c = 0; c < entry->num_checks; c++) {
+                Check *check = &entry->checks[c];
+
+                if (check->has_expected && check->actual != check->expected)
+                    printf("FAIL %s frame %u: %016llx, expected %016llx\n",
+                            entry->rom_file,
+                            check->frame,
+                            (unsigned long long)check->actual,
+                            (unsigned long long)check->expected
+                    );
+            }
+        }
+
+        if (entry->result == ENTRY_PASS) passed++;
+        else if (entry->result == ENTRY_FAIL) failed++;
+        else errors++;
+    }
+
+    fprintf(stderr, "%u passed, %u failed, %u errors\n", passed, failed, errors);
+    fprintf(
+            stderr,
+            "%llu frames on %ld threads in %.2f s: %.0f frames/s (%.1fx real time)\n",
+            (unsigned long long)frames,
+            num_threads,
+            (double)elapsed / 1e9,
+            (double)frames * 1e9 / (double)elapsed,
+            (double)frames * NS_PER_FRAME / (double)elapsed
+    );
+
+    pthread_mutex_destroy(&runner.lock);
+    free(threads);
+    free(runner.entries);
+
+    return (failed > 0 || errors > 0) ? 1 : 0;
+}
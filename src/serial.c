@@ -0,0 +1,122 @@
+#include "serial.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "gb.h"
+
+#define CAPTURE_INITIAL_SIZE 256
+
+void serial_init(Serial *serial, GB *gb) {
+    *serial = (Serial){
+        .transfer_cycles = 0,
+        .exchange = NULL,
+        .userdata = NULL,
+        .gb = gb
+    };
+}
+
+void serial_step(Serial *serial, uint8_t cycles) {
+    if (serial->transfer_cycles == 0) return;
+
+    if (serial->transfer_cycles > cycles) {
+        serial->transfer_cycles -= cycles;
+        return;
+    }
+
+    uint8_t *io = serial->gb->io;
+    uint8_t in = 0xFF;
+
+    // the exchange still sees the cycles that were left, which
+    // tells it exactly when during this step the transfer completed
+    if (serial->exchange != NULL) in = serial->exchange(serial->userdata, io[SB_ADDR_RELATIVE]);
+
+    serial->transfer_cycles = 0;
+
+    io[SB_ADDR_RELATIVE] = in;
+    io[SC_ADDR_RELATIVE] &= ~SC_TRANSFER_ENABLE_MASK;
+
+    gb_interrupt(serial->gb, INTERRUPT_SERIAL);
+}
+
+void serial_control_write(Serial *serial, uint8_t val) {
+    // with the external clock the transfer only progresses
+    // when the other side clocks it, see serial_clock_external()
+    if ((val & SC_TRANSFER_ENABLE_MASK) && (val & SC_CLOCK_SELECT_MASK))
+        serial->transfer_cycles = SERIAL_TRANSFER_CYCLES;
+    else
+        serial->transfer_cycles = 0;
+}
+
+// the other side of the link cable shifted 'in' over with its clock,
+// returns what was shifted out, 0xFF when no transfer was waiting
+uint8_t serial_clock_external(Serial *serial, uint8_t in) {
+    uint8_t *io = serial->gb->io;
+
+    if ((io[SC_ADDR_RELATIVE] & SC_TRANSFER_ENABLE_MASK) == 0 ||
+        (io[SC_ADDR_RELATIVE] & SC_CLOCK_SELECT_MASK) != 0)
+        return 0xFF;
+
+    uint8_t out = io[SB_ADDR_RELATIVE];
+
+    io[SB_ADDR_RELATIVE] = in;
+    io[SC_ADDR_RELATIVE] &= ~SC_TRANSFER_ENABLE_MASK;
+
+    gb_interrupt(serial->gb, INTERRUPT_SERIAL);
+
+    return out;
+}
+
+void serial_set_exchange(Serial *serial, SerialExchange exchange, void *userdata) {
+    serial->exchange = exchange;
+    serial->userdata = userdata;
+}
+
+// 'filename' may be NULL to only capture into memory
+SerialCapture *create_serial_capture(const char *filename) {
+    SerialCapture *new_capture = (SerialCapture*)malloc(sizeof(SerialCapture));
+
+    new_capture->data = (uint8_t*)malloc(CAPTURE_INITIAL_SIZE + 1);
+    new_capture->data[0] = '\0';
+    new_capture->size = 0;
+    new_capture->capacity = CAPTURE_INITIAL_SIZE;
+    new_capture->file = NULL;
+
+    if (filename != NULL) {
+        new_capture->file = fopen(filename, "wb");
+
+        if (new_capture->file == NULL)
+            fprintf(stderr, "create_serial_capture(): Failed to open file: %s\n", filename);
+    }
+
+    return new_capture;
+}
+
+void destroy_serial_capture(SerialCapture *capture) {
+    if (capture == NULL) return;
+
+    if (capture->file != NULL) fclose(capture->file);
+
+    free(capture->data);
+    free(capture);
+}
+
+uint8_t serial_capture_exchange(void *userdata, uint8_t out) {
+    SerialCapture *capture = (SerialCapture*)userdata;
+
+    if (capture->size == capture->capacity) {
+        capture->capacity *= 2;
+        capture->data = (uint8_t*)realloc(capture->data, capture->capacity + 1);
+    }
+
+    // kept NUL-terminated, so text output can be used as a string
+    capture->data[capture->size++] = out;
+    capture->data[capture->size] = '\0';
+
+    if (capture->file != NULL) {
+        fputc(out, capture->file);
+        fflush(capture->file);
+    }
+
+    return 0xFF;
+}
@@ -0,0 +1,60 @@
+#ifndef SERIAL_H
+#define SERIAL_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define SB_ADDR 0xFF01
+#define SC_ADDR 0xFF02
+
+// addresses relative to the start of IO memory
+#define SB_ADDR_RELATIVE 0x0001
+#define SC_ADDR_RELATIVE 0x0002
+
+#define SC_TRANSFER_ENABLE_MASK 0x80
+#define SC_CLOCK_SELECT_MASK    0x01
+
+// 8 bits at 8192 Hz with the internal clock
+#define SERIAL_TRANSFER_CYCLES 1024
+
+// called when a transfer completes with the byte that was shifted out,
+// returns the byte shifted in from the other side
+typedef uint8_t (*SerialExchange)(void *userdata, uint8_t out);
+
+typedef struct Serial {
+    // M-cycles until the transfer in progress completes, 0 when idle
+    uint16_t transfer_cycles;
+
+    // without an exchange nothing is connected and 0xFF is shifted in
+    SerialExchange exchange;
+    void *userdata;
+
+    struct GB *gb;
+} Serial;
+
+// a sink that keeps everything sent over the link cable,
+// e.g. the results reported by test ROMs
+typedef struct SerialCapture {
+    uint8_t *data;
+    uint32_t size;
+    uint32_t capacity;
+    FILE *file; // optional copy of the output
+} SerialCapture;
+
+void serial_init(Serial *serial, struct GB *gb);
+
+void serial_step(Serial *serial, uint8_t cycles);
+
+void serial_control_write(Serial *serial, uint8_t val);
+
+uint8_t serial_clock_external(Serial *serial, uint8_t in);
+
+void serial_set_exchange(Serial *serial, SerialExchange exchange, void *userdata);
+
+SerialCapture *create_serial_capture(const char *filename);
+
+void destroy_serial_capture(SerialCapture *capture);
+
+uint8_t serial_capture_exchange(void *userdata, uint8_t out);
+
+#endif
@@ -0,0 +1,68 @@
+#include "gb.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+// cart_serial - runs a test ROM headless and prints what it sends over the link cable
+//
+// usage: cart_serial [-s] <rom> [max frames]
+//
+// Test ROMs in the style of blargg's report "Passed" or "Failed" over the
+// serial port, the exit code is 0, 1 or 2 when neither showed up in time.
+// With -s the boot ROM is skipped (see gb_skip_boot()).
+
+#define DEFAULT_MAX_FRAMES 36000 // ten minutes of emulated time
+
+int main(int argc, char *argv[]) {
+    uint8_t skip_boot = argc >= 2 && strcmp(argv[1], "-s") == 0;
+    int arg = skip_boot ? 2 : 1;
+
+    if (argc < arg + 1) {
+        fprintf(stderr, "usage: %s [-s] <rom> [max frames]\n", argv[0]);
+        return -1;
+    }
+
+    uint32_t max_frames = (argc >= arg + 2) ? (uint32_t)atoi(argv[arg + 1]) : DEFAULT_MAX_FRAMES;
+
+    GB *gb = create_gb(argv[arg]);
+
+    if (gb == NULL) return -1;
+
+    if (skip_boot) gb_skip_boot(gb);
+
+    SerialCapture *capture = create_serial_capture(NULL);
+    serial_set_exchange(&gb->serial, serial_capture_exchange, capture);
+
+    // nothing is looked at, so nothing has to be drawn
+    ppu_set_render_enable(&gb->ppu, 0);
+
+    uint64_t start = get_time_ns();
+    uint32_t frame = 0;
+    int result = 2;
+
+    for (; frame < max_frames && result == 2; frame++) {
+        gb_run_frame(gb);
+
+        if (strstr((const char*)capture->data, "Passed") != NULL) result = 0;
+        else if (strstr((const char*)capture->data, "Failed") != NULL) result = 1;
+    }
+
+    uint64_t elapsed = MAX(get_time_ns() - start, 1);
+
+    fwrite(capture->data, 1, capture->size, stdout);
+    if (capture->size > 0 && capture->data[capture->size - 1] != '\n') printf("\n");
+
+    fprintf(
+            stderr,
+            "%s after %u frames in %.1f ms\n",
+            (result == 0) ? "passed" : (result == 1) ? "failed" : "timed out",
+            frame,
+            (double)elapsed / 1e6
+    );
+
+    destroy_serial_capture(capture);
+    destroy_gb(gb);
+    return result;
+}
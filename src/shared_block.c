@@ -0,0 +1,85 @@
+#include "shared_block.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+// 'size' zeroed bytes
+SharedBlock *create_shared_block(uint32_t size) {
+    return create_shared_block_from((uint8_t*)calloc(size, 1), size);
+}
+
+// the block takes ownership of data, which has to be allocated with malloc()
+SharedBlock *create_shared_block_from(uint8_t *data, uint32_t size) {
+    SharedBlock *new_block = (SharedBlock*)malloc(sizeof(SharedBlock));
+
+    new_block->data = data;
+    new_block->size = size;
+    new_block->refs = 1;
+    new_block->arena = NULL;
+
+    return new_block;
+}
+
+// 'size' zeroed bytes in 'arena', NULL when it is full
+SharedBlock *create_shared_block_in(Arena *arena, uint32_t size) {
+    SharedBlock *new_block = (SharedBlock*)arena_alloc(arena, sizeof(SharedBlock));
+    uint8_t *data = (uint8_t*)arena_alloc(arena, size);
+
+    if (new_block == NULL || data == NULL) return NULL;
+
+    new_block->data = data;
+    new_block->size = size;
+    new_block->refs = 1;
+    new_block->arena = arena_ref(arena);
+
+    return new_block;
+}
+
+SharedBlock *shared_block_ref(SharedBlock *block) {
+    block->refs++;
+    return block;
+}
+
+void shared_block_release(SharedBlock *block) {
+    if (block == NULL || --block->refs > 0) return;
+
+    if (block->arena != NULL) {
+        arena_release(block->arena);
+        return;
+    }
+
+    free(block->data);
+    free(block);
+}
+
+// replaces a shared block with a private copy, returns its data
+uint8_t *shared_block_own(SharedBlock **block) {
+    SharedBlock *shared = *block;
+
+    if (shared->refs == 1) return shared->data;
+
+    SharedBlock *own = create_shared_block_from((uint8_t*)malloc(shared->size), shared->size);
+    memcpy(own->data, shared->data, shared->size);
+
+    shared->refs--;
+    *block = own;
+
+    return own->data;
+}
+
+// replaces a block with a copy in 'arena' even when it wasn't shared,
+// returns its data or NULL (keeping the block) when the arena is full
+uint8_t *shared_block_own_in(SharedBlock **block, Arena *arena) {
+    SharedBlock *own = create_shared_block_in(arena, (*block)->size);
+
+    if (own == NULL) return NULL;
+
+    memcpy(own->data, (*block)->data, own->size);
+
+    shared_block_release(*block);
+    *block = own;
+
+    return own->data;
+}
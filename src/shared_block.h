@@ -0,0 +1,42 @@
+#ifndef SHARED_BLOCK_H
+#define SHARED_BLOCK_H
+
+#include <stdint.h>
+
+// Reference counted memory for copy-on-write.
+//
+// Forked GBs share their memory blocks (VRAM, WRAM, SRAM, the
+// framebuffer and the ROM) until one of them writes to a block, which
+// then gets its own copy first, see shared_block_own(). The counts
+// aren't atomic, so a GB and its forks have to stay on one thread.
+// A block can also live in an arena (see arena.h), which it keeps
+// referenced instead of freeing anything.
+
+typedef struct SharedBlock {
+    uint8_t *data;
+    uint32_t size;
+    uint32_t refs;
+
+    // NULL when the block and its data were allocated with malloc()
+    struct Arena *arena;
+} SharedBlock;
+
+SharedBlock *create_shared_block(uint32_t size);
+
+SharedBlock *create_shared_block_from(uint8_t *data, uint32_t size);
+
+SharedBlock *create_shared_block_in(struct Arena *arena, uint32_t size);
+
+SharedBlock *shared_block_ref(SharedBlock *block);
+
+void shared_block_release(SharedBlock *block);
+
+uint8_t *shared_block_own(SharedBlock **block);
+
+uint8_t *shared_block_own_in(SharedBlock **block, struct Arena *arena);
+
+// makes the block private before 'data' (pointing into it) is written
+#define SHARED_BLOCK_WRITE(block, data) \
+    do { if ((block)->refs > 1) (data) = shared_block_own(&(block)); } while (0)
+
+#endif
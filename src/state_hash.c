@@ -0,0 +1,109 @@
+#include "state_hash.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash.h"
+#include "util.h"
+
+// everything that is hashed whole on every update
+#define REGS_SIZE (19 + IO_SIZE + HRAM_SIZE + 15)
+
+StateHash *create_state_hash(uint8_t hash_frames) {
+    StateHash *new_state_hash = (StateHash*)malloc(sizeof(StateHash));
+
+    state_hash_invalidate(new_state_hash);
+
+    new_state_hash->hash_frames = hash_frames;
+    new_state_hash->frame_hash = 0;
+
+    return new_state_hash;
+}
+
+void destroy_state_hash(StateHash *state_hash) {
+    free(state_hash);
+}
+
+// forces every page to be rehashed, e.g. after loading a state
+void state_hash_invalidate(StateHash *state_hash) {
+    memset(state_hash->dirty, 1, STATE_HASH_MAX_PAGES);
+    state_hash->sram_dirty = 1;
+}
+
+static void hash_pages(StateHash *state_hash, uint32_t first_page, const uint8_t *data, uint32_t size) {
+    for (uint32_t p = 0; p * STATE_HASH_PAGE_SIZE < size; p++) {
+        if (state_hash->dirty[first_page + p] == 0) continue;
+
+        uint32_t len = MIN(size - p * STATE_HASH_PAGE_SIZE, STATE_HASH_PAGE_SIZE);
+
+        state_hash->page_hashes[first_page + p] = hash64(data + p * STATE_HASH_PAGE_SIZE, len, first_page + p);
+        state_hash->dirty[first_page + p] = 0;
+    }
+}
+
+uint64_t state_hash_update(StateHash *state_hash, GB *gb) {
+    Cartridge *cart = gb->cartridge;
+    uint32_t sram_size = MIN(cart->ram_size, KIB_128);
+    uint32_t sram_pages = (sram_size + STATE_HASH_PAGE_SIZE - 1) / STATE_HASH_PAGE_SIZE;
+
+    if (state_hash->sram_dirty == 1) {
+        memset(&state_hash->dirty[STATE_HASH_SRAM_PAGE], 1, sram_pages);
+        state_hash->sram_dirty = 0;
+    }
+
+    hash_pages(state_hash, STATE_HASH_VRAM_PAGE, gb->vram, VRAM_SIZE);
+    hash_pages(state_hash, STATE_HASH_WRAM_PAGE, gb->wram, WRAM_SIZE);
+    hash_pages(state_hash, STATE_HASH_OAM_PAGE, gb->oam, OAM_SIZE);
+    hash_pages(state_hash, STATE_HASH_SRAM_PAGE, cart->ram, sram_size);
+
+    // fields are packed by hand, struct padding isn't deterministic
+    uint8_t regs[REGS_SIZE];
+    uint8_t *r = regs;
+
+    CPU *cpu = &gb->cpu;
+
+    *r++ = cpu->a;
+    *r++ = cpu->f;
+    *r++ = cpu->b;
+    *r++ = cpu->c;
+    *r++ = cpu->d;
+    *r++ = cpu->e;
+    *r++ = cpu->h;
+    *r++ = cpu->l;
+    *r++ = cpu->pc & 0xFF;
+    *r++ = cpu->pc >> 8;
+    *r++ = cpu->sp & 0xFF;
+    *r++ = cpu->sp >> 8;
+    *r++ = cpu->ime;
+    *r++ = cpu->ime_set_pending;
+    *r++ = cpu->halted;
+    *r++ = gb->mmu.bootrom_mapped;
+    *r++ = gb->mmu.dma_cycles;
+    *r++ = gb->mmu.dma_source;
+    *r++ = gb->mmu.dma_starting;
+
+    memcpy(r, gb->io, IO_SIZE);
+    r += IO_SIZE;
+    memcpy(r, gb->hram, HRAM_SIZE);
+    r += HRAM_SIZE;
+
+    *r++ = gb->ie;
+    *r++ = cart->ram_enable;
+    *r++ = cart->primary_bank;
+    *r++ = cart->secondary_bank;
+    *r++ = cart->banking_mode;
+    *r++ = gb->ppu.mode;
+    *r++ = gb->ppu.current_dot & 0xFF;
+    *r++ = gb->ppu.current_dot >> 8;
+    *r++ = gb->ppu.current_line;
+    *r++ = gb->timer.timer_counter;
+    *r++ = gb->timer.divider_counter;
+    *r++ = gb->joypad.buttons;
+    *r++ = gb->joypad.dpad;
+    *r++ = gb->serial.transfer_cycles & 0xFF;
+    *r++ = gb->serial.transfer_cycles >> 8;
+
+    uint64_t regs_hash = hash64(regs, REGS_SIZE, 0);
+
+    return hash64(state_hash->page_hashes, (STATE_HASH_SRAM_PAGE + sram_pages) * sizeof(uint64_t), regs_hash);
+}
@@ -0,0 +1,49 @@
+#ifndef STATE_HASH_H
+#define STATE_HASH_H
+
+#include <stdint.h>
+
+#include "gb.h"
+
+// Incremental hashing for gb_state_hash().
+//
+// VRAM, WRAM, OAM and cartridge SRAM are hashed in pages whose hashes
+// are cached and only recomputed when the MMU marked them as written.
+// The final hash combines the page hashes with the CPU registers, IO,
+// HRAM and the banking state, which are small enough to hash every time.
+
+#define STATE_HASH_PAGE_SIZE 256
+
+#define STATE_HASH_VRAM_PAGE 0
+#define STATE_HASH_WRAM_PAGE (STATE_HASH_VRAM_PAGE + VRAM_SIZE / STATE_HASH_PAGE_SIZE)
+#define STATE_HASH_OAM_PAGE  (STATE_HASH_WRAM_PAGE + WRAM_SIZE / STATE_HASH_PAGE_SIZE)
+#define STATE_HASH_SRAM_PAGE (STATE_HASH_OAM_PAGE + 1)
+#define STATE_HASH_MAX_PAGES (STATE_HASH_SRAM_PAGE + KIB_128 / STATE_HASH_PAGE_SIZE)
+
+typedef struct StateHash {
+    uint64_t page_hashes[STATE_HASH_MAX_PAGES];
+    uint8_t dirty[STATE_HASH_MAX_PAGES];
+
+    // SRAM is banked by the cartridge, so a write marks all of it
+    uint8_t sram_dirty;
+
+    // when set, frame_hash is updated at the end of every gb_run_frame()
+    uint8_t hash_frames;
+    uint64_t frame_hash;
+} StateHash;
+
+StateHash *create_state_hash(uint8_t hash_frames);
+
+void destroy_state_hash(StateHash *state_hash);
+
+void state_hash_invalidate(StateHash *state_hash);
+
+uint64_t state_hash_update(StateHash *state_hash, struct GB *gb);
+
+#define STATE_HASH_MARK(gb, page) \
+    do { if ((gb)->state_hash != NULL) (gb)->state_hash->dirty[(page)] = 1; } while (0)
+
+#define STATE_HASH_MARK_SRAM(gb) \
+    do { if ((gb)->state_hash != NULL) (gb)->state_hash->sram_dirty = 1; } while (0)
+
+#endif
@@ -0,0 +1,152 @@
+#include "stats.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+
+// the TSC is far cheaper to read than the system clock, which matters
+// when every component of every gb_step() is timed
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#define STATS_HAVE_TSC
+#endif
+
+#define CALIBRATION_NS 10000000 // 10 ms
+
+static const char *TIMER_NAMES[STATS_TIMER_COUNT] = {
+    "cpu_ns",
+    "dma_ns",
+    "ppu_ns",
+    "apu_ns",
+    "timer_ns",
+    "convert_ns",
+    "present_ns"
+};
+
+static const char *COUNTER_NAMES[STATS_COUNTER_COUNT] = {
+    "instructions",
+    "mmu_slow_reads",
+    "tile_fetches",
+    "dma_transfers",
+    "interrupts",
+    "obj_table_builds",
+    "timed_lines"
+};
+
+static double calibrate_ticks(void) {
+#ifdef STATS_HAVE_TSC
+    uint64_t start_ns = get_time_ns();
+    uint64_t start_ticks = stats_ticks();
+
+    while (get_time_ns() - start_ns < CALIBRATION_NS);
+
+    return (double)(get_time_ns() - start_ns) / (double)(stats_ticks() - start_ticks);
+#else
+    return 1.0;
+#endif
+}
+
+Stats *create_stats(uint32_t capacity) {
+    Stats *new_stats = (Stats*)calloc(1, sizeof(Stats));
+
+    new_stats->frames = (StatsFrame*)calloc(capacity, sizeof(StatsFrame));
+    new_stats->capacity = capacity;
+    new_stats->ns_per_tick = calibrate_ticks();
+
+    return new_stats;
+}
+
+void destroy_stats(Stats *stats) {
+    if (stats == NULL) return;
+
+    free(stats->frames);
+    free(stats);
+}
+
+uint64_t stats_ticks(void) {
+#ifdef STATS_HAVE_TSC
+    return __rdtsc();
+#else
+    return get_time_ns();
+#endif
+}
+
+void stats_lap(Stats *stats, StatsTimer timer, uint64_t *last_ticks) {
+    uint64_t now = stats_ticks();
+
+    stats->ticks[timer] += now - *last_ticks;
+    *last_ticks = now;
+}
+
+void stats_end_frame(Stats *stats) {
+    StatsFrame *frame = &stats->frames[stats->num_frames++ % stats->capacity];
+
+    for (uint8_t t = 0; t < STATS_TIMER_COUNT; t++)
+        frame->ns[t] = (uint64_t)((double)stats->ticks[t] * stats->ns_per_tick);
+
+    memcpy(frame->counts, stats->counts, sizeof(frame->counts));
+
+    memset(stats->ticks, 0, sizeof(stats->ticks));
+    memset(stats->counts, 0, sizeof(stats->counts));
+}
+
+uint32_t stats_num_frames(Stats *stats) {
+    return (stats->num_frames < stats->capacity) ? (uint32_t)stats->num_frames : stats->capacity;
+}
+
+// idx 0 is the oldest frame still kept
+const StatsFrame *stats_get_frame(Stats *stats, uint32_t idx) {
+    uint64_t first = stats->num_frames - stats_num_frames(stats);
+
+    return &stats->frames[(first + idx) % stats->capacity];
+}
+
+void stats_write_csv(Stats *stats, FILE *file) {
+    fprintf(file, "frame");
+
+    for (uint8_t t = 0; t < STATS_TIMER_COUNT; t++) fprintf(file, ",%s", TIMER_NAMES[t]);
+    for (uint8_t c = 0; c < STATS_COUNTER_COUNT; c++) fprintf(file, ",%s", COUNTER_NAMES[c]);
+
+    fprintf(file, "\n");
+
+    uint64_t first = stats->num_frames - stats_num_frames(stats);
+
+    for (uint32_t f = 0; f < stats_num_frames(stats); f++) {
+        const StatsFrame *frame = stats_get_frame(stats, f);
+
+        fprintf(file, "%llu", (unsigned long long)(first + f));
+
+        for (uint8_t t = 0; t < STATS_TIMER_COUNT; t++)
+            fprintf(file, ",%llu", (unsigned long long)frame->ns[t]);
+        for (uint8_t c = 0; c < STATS_COUNTER_COUNT; c++)
+            fprintf(file, ",%llu", (unsigned long long)frame->counts[c]);
+
+        fprintf(file, "\n");
+    }
+}
+
+void stats_write_json(Stats *stats, FILE *file) {
+    fprintf(file, "{\n  \"frames\": [\n");
+
+    uint64_t first = stats->num_frames - stats_num_frames(stats);
+
+    for (uint32_t f = 0; f < stats_num_frames(stats); f++) {
+        const StatsFrame *frame = stats_get_frame(stats, f);
+
+        fprintf(file, "    {\"frame\": %llu", (unsigned long long)(first + f));
+
+        for (uint8_t t = 0; t < STATS_TIMER_COUNT; t++)
+            fprintf(file, ", \"%s\": %llu", TIMER_NAMES[t], (unsigned long long)frame->ns[t]);
+        for (uint8_t c = 0; c < STATS_COUNTER_COUNT; c++)
+            fprintf(file, ", \"%s\": %llu", COUNTER_NAMES[c], (unsigned long long)frame->counts[c]);
+
+        fprintf(file, "}%s\n", (f + 1 < stats_num_frames(stats)) ? "," : "");
+    }
+
+    fprintf(file, "  ]\n}\n");
+}
@@ -0,0 +1,87 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Host-side instrumentation, only compiled in with CART_STATS defined.
+//
+// Every frame, host time spent in each component and a few event
+// counters are accumulated, then moved into a ring of past frames
+// when stats_end_frame() is called. The core ends its frames at
+// VBlank, the frontend keeps its own Stats for conversion and present.
+
+typedef enum StatsTimer {
+    STATS_TIMER_CPU,
+    STATS_TIMER_DMA,
+    STATS_TIMER_PPU,
+    STATS_TIMER_APU,
+    STATS_TIMER_TIMER,
+    STATS_TIMER_CONVERT,
+    STATS_TIMER_PRESENT,
+    STATS_TIMER_COUNT
+} StatsTimer;
+
+typedef enum StatsCounter {
+    STATS_COUNTER_INSTRUCTIONS,
+    STATS_COUNTER_MMU_SLOW_READS, // reads dispatched to the cartridge or IO
+    STATS_COUNTER_TILE_FETCHES,
+    STATS_COUNTER_DMA_TRANSFERS,
+    STATS_COUNTER_INTERRUPTS,
+    STATS_COUNTER_OBJ_TABLE_BUILDS,
+    STATS_COUNTER_TIMED_LINES, // lines redrawn for mid-line register writes
+    STATS_COUNTER_COUNT
+} StatsCounter;
+
+typedef struct StatsFrame {
+    uint64_t ns[STATS_TIMER_COUNT];
+    uint64_t counts[STATS_COUNTER_COUNT];
+} StatsFrame;
+
+typedef struct Stats {
+    // the frame being recorded, timers are in ticks until it ends
+    uint64_t ticks[STATS_TIMER_COUNT];
+    uint64_t counts[STATS_COUNTER_COUNT];
+
+    StatsFrame *frames;
+    uint32_t capacity;
+    uint64_t num_frames;
+
+    double ns_per_tick;
+} Stats;
+
+Stats *create_stats(uint32_t capacity);
+
+void destroy_stats(Stats *stats);
+
+uint64_t stats_ticks(void);
+
+void stats_lap(Stats *stats, StatsTimer timer, uint64_t *last_ticks);
+
+void stats_end_frame(Stats *stats);
+
+uint32_t stats_num_frames(Stats *stats);
+
+const StatsFrame *stats_get_frame(Stats *stats, uint32_t idx);
+
+void stats_write_csv(Stats *stats, FILE *file);
+
+void stats_write_json(Stats *stats, FILE *file);
+
+#ifdef CART_STATS
+#define STATS_BEGIN(stats) \
+    uint64_t stats_last_ticks = ((stats) != NULL) ? stats_ticks() : 0
+#define STATS_LAP(stats, timer) \
+    do { if ((stats) != NULL) stats_lap((stats), (timer), &stats_last_ticks); } while (0)
+#define STATS_COUNT(stats, counter) \
+    do { if ((stats) != NULL) (stats)->counts[(counter)]++; } while (0)
+#define STATS_END_FRAME(stats) \
+    do { if ((stats) != NULL) stats_end_frame((stats)); } while (0)
+#else
+#define STATS_BEGIN(stats)
+#define STATS_LAP(stats, timer) ((void)0)
+#define STATS_COUNT(stats, counter) ((void)0)
+#define STATS_END_FRAME(stats) ((void)0)
+#endif
+
+#endif
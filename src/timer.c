@@ -25,39 +25,70 @@ void timer_init(Timer *timer, GB *gb) {
     timer->gb = gb;
 }
 
+// advances 'counter' by 'cycles' the way incrementing it one cycle at a time
+// would, it restarts from 0 whenever it reaches 'period' (which a uint8_t
+// only ever does after wrapping around if it's already past it)
+static uint8_t count_periods(uint8_t *counter, uint16_t period, uint8_t cycles) {
+    uint8_t periods = 0;
+
+    if (period > 0xFF) {
+        *counter += cycles;
+        return 0;
+    }
+
+    while (cycles > 0) {
+        uint8_t until = (uint8_t)(period - *counter);
+        uint16_t left = (until == 0) ? 256 : until;
+
+        if (cycles < left) {
+            *counter += cycles;
+            break;
+        }
+
+        cycles -= left;
+        *counter = 0;
+        periods++;
+    }
+
+    return periods;
+}
+
 void timer_step(Timer *timer, uint8_t cycles) {
     uint8_t tac = timer->gb->io[TAC_ADDR_RELATIVE];
 
     uint8_t tima = timer->gb->io[TIMA_ADDR_RELATIVE];
 
-    for (uint8_t c = 0; c < cycles; c++) {
-        timer->divider_counter++;
-
-        if (timer->divider_counter == DIV_INC_CYCLES) {
-            timer->gb->io[DIV_ADDR_RELATIVE]++;
-            timer->divider_counter = 0;
-        }
-        
-        if (!(tac & TAC_ENABLE_MASK)) continue;
+    timer->gb->io[DIV_ADDR_RELATIVE] += count_periods(&timer->divider_counter, DIV_INC_CYCLES, cycles);
 
-        timer->timer_counter++;
+    if (!(tac & TAC_ENABLE_MASK)) return;
 
-        if (timer->timer_counter == get_clock_inc_cycles(tac & TAC_CLOCK_SELECT_MASK)) {
-            if (tima == 0xFF) {
-                tima = timer->gb->io[TMA_ADDR_RELATIVE];
-                gb_interrupt(timer->gb, INTERRUPT_TIMER);
-            }
-            else
-                tima++;
+    uint8_t ticks = count_periods(&timer->timer_counter, get_clock_inc_cycles(tac & TAC_CLOCK_SELECT_MASK), cycles);
 
-            timer->gb->io[TIMA_ADDR_RELATIVE] = tima;
-            timer->timer_counter = 0;
+    for (uint8_t t = 0; t < ticks; t++) {
+        if (tima == 0xFF) {
+            tima = timer->gb->io[TMA_ADDR_RELATIVE];
+            gb_interrupt(timer->gb, INTERRUPT_TIMER);
         }
+        else
+            tima++;
 
-        
+        timer->gb->io[TIMA_ADDR_RELATIVE] = tima;
     }
 }
 
+// cycles that can pass before TIMA overflows and requests an interrupt
+uint32_t timer_quiet_cycles(Timer *timer) {
+    uint8_t tac = timer->gb->io[TAC_ADDR_RELATIVE];
+    uint16_t period = get_clock_inc_cycles(tac & TAC_CLOCK_SELECT_MASK);
+
+    if (!(tac & TAC_ENABLE_MASK) || period > 0xFF) return UINT32_MAX;
+
+    uint8_t until = (uint8_t)(period - timer->timer_counter);
+    uint32_t next_tick = (until == 0) ? 256 : until;
+
+    return next_tick + (uint32_t)(0xFF - timer->gb->io[TIMA_ADDR_RELATIVE]) * period - 1;
+}
+
 void timer_div_reset(Timer *timer) {
     timer->gb->io[DIV_ADDR_RELATIVE] = 0x00;
 }
\ No newline at end of file
@@ -32,6 +32,8 @@ void timer_init(Timer *timer, struct GB *gb);
 
 void timer_step(Timer *timer, uint8_t cycles);
 
+uint32_t timer_quiet_cycles(Timer *timer);
+
 void timer_div_reset(Timer *timer);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,80 @@
+#include "trace.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "util.h"
+
+Trace *create_trace(uint32_t capacity) {
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0) {
+        fprintf(stderr, "create_trace(): Capacity has to be a power of 2: %u\n", capacity);
+        return NULL;
+    }
+
+    Trace *new_trace = (Trace*)malloc(sizeof(Trace));
+
+    new_trace->records = (TraceRecord*)malloc(capacity * sizeof(TraceRecord));
+    new_trace->capacity = capacity;
+    new_trace->count = 0;
+
+    return new_trace;
+}
+
+void destroy_trace(Trace *trace) {
+    if (trace == NULL) return;
+
+    free(trace->records);
+    free(trace);
+}
+
+void trace_instruction(Trace *trace, GB *gb, uint16_t pc, uint8_t opcode) {
+    CPU *cpu = &gb->cpu;
+
+    trace->records[trace->count++ & (trace->capacity - 1)] = (TraceRecord){
+        .cycle = gb->cycles,
+        .pc = pc,
+        .bank = gb_code_bank(gb, pc),
+        .sp = cpu->sp,
+        .opcode = opcode,
+        .a = cpu->a,
+        .f = cpu->f,
+        .b = cpu->b,
+        .c = cpu->c,
+        .d = cpu->d,
+        .e = cpu->e,
+        .h = cpu->h,
+        .l = cpu->l,
+        .ime = cpu->ime
+    };
+}
+
+uint8_t trace_write(Trace *trace, const char *filename) {
+    FILE *file = fopen(filename, "wb");
+
+    if (file == NULL) {
+        fprintf(stderr, "trace_write(): Failed to open file: %s\n", filename);
+        return 0;
+    }
+
+    uint32_t num_records = (trace->count < trace->capacity) ? (uint32_t)trace->count : trace->capacity;
+
+    TraceHeader header = {
+        .record_size = sizeof(TraceRecord),
+        .num_records = num_records
+    };
+
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+
+    fwrite(&header, sizeof(TraceHeader), 1, file);
+
+    // oldest record first
+    uint32_t first = (uint32_t)((trace->count - num_records) & (trace->capacity - 1));
+    uint32_t tail = MIN(num_records, trace->capacity - first);
+
+    fwrite(trace->records + first, sizeof(TraceRecord), tail, file);
+    fwrite(trace->records, sizeof(TraceRecord), num_records - tail, file);
+
+    fclose(file);
+    return 1;
+}
@@ -0,0 +1,64 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#include "gb.h"
+
+// Binary execution trace, only compiled in with CART_TRACE defined.
+//
+// Every executed instruction is stored as a fixed-size record in a
+// per-instance ring buffer, so the last 'capacity' instructions are
+// always available. The records are decoded and diffed offline by
+// the cart_trace tool.
+
+#define TRACE_MAGIC "CARTTRC1"
+
+// records hold the CPU state before the instruction is executed
+typedef struct TraceRecord {
+    uint64_t cycle;
+    uint16_t pc;
+    uint16_t bank;
+    uint16_t sp;
+    uint8_t opcode;
+    uint8_t a;
+    uint8_t f;
+    uint8_t b;
+    uint8_t c;
+    uint8_t d;
+    uint8_t e;
+    uint8_t h;
+    uint8_t l;
+    uint8_t ime;
+} TraceRecord;
+
+// trace files are this header followed by num_records records,
+// oldest first, in the byte order of the machine that wrote them
+typedef struct TraceHeader {
+    char magic[8];
+    uint32_t record_size;
+    uint32_t num_records;
+} TraceHeader;
+
+typedef struct Trace {
+    TraceRecord *records;
+    uint32_t capacity; // has to be a power of 2
+    uint64_t count;
+} Trace;
+
+Trace *create_trace(uint32_t capacity);
+
+void destroy_trace(Trace *trace);
+
+void trace_instruction(Trace *trace, struct GB *gb, uint16_t pc, uint8_t opcode);
+
+uint8_t trace_write(Trace *trace, const char *filename);
+
+#ifdef CART_TRACE
+#define TRACE_INSTRUCTION(gb, pc, opcode) \
+    do { if ((gb)->trace != NULL) trace_instruction((gb)->trace, (gb), (pc), (opcode)); } while (0)
+#else
+#define TRACE_INSTRUCTION(gb, pc, opcode) ((void)0)
+#endif
+
+#endif
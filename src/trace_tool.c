@@ -0,0 +1,148 @@
+#include "trace.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+// cart_trace - decodes trace files written by trace_write()
+//
+// usage: cart_trace dump <trace> [last N records]
+//        cart_trace diff <trace a> <trace b> [context records]
+
+#define DEFAULT_DIFF_CONTEXT 16
+
+typedef struct TraceFile {
+    TraceRecord *records;
+    uint32_t num_records;
+} TraceFile;
+
+static uint8_t read_trace_file(TraceFile *trace, const char *filename) {
+    FILE *file = fopen(filename, "rb");
+
+    if (file == NULL) {
+        fprintf(stderr, "read_trace_file(): Failed to open file: %s\n", filename);
+        return 0;
+    }
+
+    TraceHeader header;
+
+    if (fread(&header, sizeof(TraceHeader), 1, file) != 1 ||
+        memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.record_size != sizeof(TraceRecord)) {
+        fprintf(stderr, "read_trace_file(): Not a trace file of this build: %s\n", filename);
+        fclose(file);
+        return 0;
+    }
+
+    trace->records = (TraceRecord*)malloc((size_t)header.num_records * sizeof(TraceRecord) + 1);
+    trace->num_records = (uint32_t)fread(trace->records, sizeof(TraceRecord), header.num_records, file);
+
+    fclose(file);
+    return 1;
+}
+
+static void print_record(const TraceRecord *rec, const char *prefix) {
+    char bank[8];
+
+    if (rec->bank == GB_BOOT_BANK) snprintf(bank, sizeof(bank), "boot");
+    else snprintf(bank, sizeof(bank), "%03X", rec->bank);
+
+    printf(
+            "%s%12llu %s:%04X  %02X  a:%02X f:%c%c%c%c b:%02X c:%02X d:%02X e:%02X h:%02X l:%02X sp:%04X ime:%u\n",
+            prefix,
+            (unsigned long long)rec->cycle,
+            bank,
+            rec->pc,
+            rec->opcode,
+            rec->a,
+            (rec->f & 0x80) ? 'Z' : '-',
+            (rec->f & 0x40) ? 'N' : '-',
+            (rec->f & 0x20) ? 'H' : '-',
+            (rec->f & 0x10) ? 'C' : '-',
+            rec->b,
+            rec->c,
+            rec->d,
+            rec->e,
+            rec->h,
+            rec->l,
+            rec->sp,
+            rec->ime
+    );
+}
+
+static uint8_t records_equal(const TraceRecord *x, const TraceRecord *y) {
+    return x->cycle == y->cycle && x->pc == y->pc && x->bank == y->bank && x->sp == y->sp
+        && x->opcode == y->opcode && x->a == y->a && x->f == y->f && x->b == y->b
+        && x->c == y->c && x->d == y->d && x->e == y->e && x->h == y->h && x->l == y->l
+        && x->ime == y->ime;
+}
+
+static int dump(const char *filename, uint32_t last) {
+    TraceFile trace;
+
+    if (read_trace_file(&trace, filename) == 0) return -1;
+
+    uint32_t first = (last > 0 && last < trace.num_records) ? trace.num_records - last : 0;
+
+    for (uint32_t r = first; r < trace.num_records; r++) print_record(&trace.records[r], "");
+
+    free(trace.records);
+    return 0;
+}
+
+static int diff(const char *filename_a, const char *filename_b, uint32_t context) {
+    TraceFile a, b;
+
+    if (read_trace_file(&a, filename_a) == 0) return -1;
+
+    if (read_trace_file(&b, filename_b) == 0) {
+        free(a.records);
+        return -1;
+    }
+
+    // the ring buffers may have wrapped at different points,
+    // so both traces are compared from the first common cycle
+    uint32_t ia = 0, ib = 0;
+
+    while (ia < a.num_records && ib < b.num_records && a.records[ia].cycle != b.records[ib].cycle) {
+        if (a.records[ia].cycle < b.records[ib].cycle) ia++;
+        else ib++;
+    }
+
+    uint32_t start_a = ia;
+    int result = 0;
+
+    for (; ia < a.num_records && ib < b.num_records; ia++, ib++) {
+        if (records_equal(&a.records[ia], &b.records[ib])) continue;
+
+        uint32_t from = (ia - start_a > context) ? ia - context : start_a;
+
+        for (uint32_t r = from; r < ia; r++) print_record(&a.records[r], "  ");
+
+        print_record(&a.records[ia], "< ");
+        print_record(&b.records[ib], "> ");
+
+        printf("traces diverge after %u matching records\n", ia - start_a);
+        result = 1;
+        break;
+    }
+
+    if (result == 0)
+        printf("traces match for %u records\n", ia - start_a);
+
+    free(a.records);
+    free(b.records);
+    return result;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc >= 3 && strcmp(argv[1], "dump") == 0)
+        return dump(argv[2], (argc >= 4) ? (uint32_t)atoi(argv[3]) : 0);
+
+    if (argc >= 4 && strcmp(argv[1], "diff") == 0)
+        return diff(argv[2], argv[3], (argc >= 5) ? (uint32_t)atoi(argv[4]) : DEFAULT_DIFF_CONTEXT);
+
+    fprintf(stderr, "usage: %s dump <trace> [last N records]\n", argv[0]);
+    fprintf(stderr, "       %s diff <trace a> <trace b> [context records]\n", argv[0]);
+    return -1;
+}
@@ -1,9 +1,17 @@
+#define _POSIX_C_SOURCE 200809L // clock_gettime()
+
 #include "util.h"
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
 uint8_t *read_file_to_array(const char *filename, uint8_t is_binary) {
     FILE *file = fopen(filename, "rb");
 
@@ -45,4 +53,22 @@ void write_bytes_to_file(const char *filename, const uint8_t *data, size_t len)
     fwrite(data, 1, len, file);
 
     fclose(file);
-}
\ No newline at end of file
+}
+
+uint64_t get_time_ns(void) {
+#ifdef _WIN32
+    LARGE_INTEGER freq, now;
+
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+
+    return (uint64_t)(now.QuadPart / freq.QuadPart) * 1000000000ull
+        + (uint64_t)(now.QuadPart % freq.QuadPart) * 1000000000ull / freq.QuadPart;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
@@ -2,6 +2,7 @@
 #define UTIL_H
 
 #include <stdint.h>
+#include <stddef.h>
 
 #define MIN(a, b) (((a) < (b)) ? (a) : (b))
 #define MAX(a, b) (((a) > (b)) ? (a) : (b))
@@ -19,4 +20,6 @@ uint8_t *read_file_to_array(const char *filename, uint8_t is_binary);
 
 void write_bytes_to_file(const char *filename, const uint8_t *data, size_t len);
 
+uint64_t get_time_ns(void);
+
 #endif